@@ -0,0 +1,162 @@
+/*
+ ******************************************************************************
+ *                               mm_cycles.c                                  *
+ *        Cycles per malloc and free of the thread cache hit paths            *
+ *                 CSE 361: Introduction to Computer Systems                  *
+ ******************************************************************************
+ */
+
+/*
+ * Times the requests that the thread cache serves, one size class at a
+ * time: every round mallocs a batch of payloads and frees them again
+ * with mm_free_sized, which keeps the bin between empty and half full so
+ * that after the first round no request takes the arena lock. The
+ * mallocs go through mm_malloc, or for the fast path through the inline
+ * mm_malloc_fast of mm_fast.h. One JSON line per size and path:
+ *
+ *     {"bench": "cycles", "path": ..., "size": ..., "ops": ...,
+ *      "malloc_cycles": ..., "free_cycles": ..., "timer": ...}
+ *
+ * malloc_cycles and free_cycles are per call, less the cost of reading
+ * the timer. The timer is the TSC on x86-64, whose ticks are reference
+ * cycles, and the monotonic clock in ns anywhere else.
+ *
+ * Build with the mm.h and memlib.c of the course handout:
+ *     gcc -O2 -DDRIVER -I. mm.c memlib.c bench/mm_cycles.c -o mm_cycles -lpthread
+ * usage: mm_cycles [-n rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __x86_64__
+#include <x86intrin.h>
+#endif
+
+#include "mm.h"
+#include "memlib.h"
+#include "mm_ext.h"
+#include "mm_fast.h"
+
+/*payloads of a round, no more than a refill leaves in the cache*/
+#define BATCH_SIZE 16
+
+static const size_t sizes[] = {16, 32, 64, 128, 256};
+
+static void run_size(size_t size, bool fast, long rounds);
+static uint64_t timer_overhead(void);
+static uint64_t now_ticks(void);
+
+int main(int argc, char **argv)
+{
+    long rounds = 1000000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1)
+    {
+        if (opt != 'n')
+        {
+            fprintf(stderr, "usage: %s [-n rounds]\n", argv[0]);
+            return 2;
+        }
+        rounds = atol(optarg);
+    }
+    if (rounds < 1)
+        rounds = 1;
+
+    mem_init();
+    if (!mm_init())
+    {
+        fprintf(stderr, "mm_init failed\n");
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        run_size(sizes[i], false, rounds);
+        run_size(sizes[i], true, rounds);
+    }
+    mem_deinit();
+    return 0;
+}
+
+/*
+ * run_size: times rounds of BATCH_SIZE mallocs and frees of size bytes
+ *     and prints the cycles per call, the first round only warms up
+ */
+static void run_size(size_t size, bool fast, long rounds)
+{
+    void *payloads[BATCH_SIZE];
+    uint64_t overhead = timer_overhead();
+    uint64_t malloc_ticks = 0;
+    uint64_t free_ticks = 0;
+
+    for (long r = 0; r <= rounds; r++)
+    {
+        uint64_t start = now_ticks();
+        uint64_t middle, end;
+
+        if (fast)
+            for (int i = 0; i < BATCH_SIZE; i++)
+                payloads[i] = mm_malloc_fast(size);
+        else
+            for (int i = 0; i < BATCH_SIZE; i++)
+                payloads[i] = mm_malloc(size);
+        middle = now_ticks();
+        for (int i = 0; i < BATCH_SIZE; i++)
+            mm_free_sized(payloads[i], size);
+        end = now_ticks();
+
+        for (int i = 0; i < BATCH_SIZE; i++)
+            if (payloads[i] == NULL)
+            {
+                fprintf(stderr, "malloc of %zu bytes failed\n", size);
+                exit(1);
+            }
+        if (r == 0)
+            continue;
+        //a round shorter than the timer itself counts as free
+        malloc_ticks += (middle - start > overhead) ? middle - start - overhead : 0;
+        free_ticks += (end - middle > overhead) ? end - middle - overhead : 0;
+    }
+
+    printf("{\"bench\": \"cycles\", \"path\": \"%s\", \"size\": %zu, \"ops\": %ld, ",
+           fast ? "fast" : "malloc", size, rounds * BATCH_SIZE);
+    printf("\"malloc_cycles\": %.2f, \"free_cycles\": %.2f, \"timer\": \"%s\"}\n",
+           (double)malloc_ticks / ((double)rounds * BATCH_SIZE),
+           (double)free_ticks / ((double)rounds * BATCH_SIZE),
+#ifdef __x86_64__
+           "tsc"
+#else
+           "ns"
+#endif
+           );
+}
+
+/*helper function to return the fewest ticks between two timer reads*/
+static uint64_t timer_overhead(void)
+{
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < 1000; i++)
+    {
+        uint64_t start = now_ticks();
+        uint64_t ticks = now_ticks() - start;
+        if (ticks < best)
+            best = ticks;
+    }
+    return best;
+}
+
+/*helper function to read the TSC, or the monotonic clock in ns*/
+static uint64_t now_ticks(void)
+{
+#ifdef __x86_64__
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
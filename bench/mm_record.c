@@ -0,0 +1,445 @@
+/*
+ ******************************************************************************
+ *                               mm_record.c                                  *
+ *          LD_PRELOAD shim that records the allocations of a program         *
+ *                 CSE 361: Introduction to Computer Systems                  *
+ ******************************************************************************
+ */
+
+/*
+ * Passes malloc, calloc, realloc and free on to the next allocator and
+ * writes each request to the file named by MM_TRACE in the format that
+ * mm_replay reads. Every live payload gets the smallest free id, so a
+ * long trace only uses as many ids as it had payloads at its peak.
+ * Payloads from before the shim was loaded and the aligned allocation
+ * functions are not recorded, and neither is freeing them. The requests
+ * of all threads go to one trace in the order they took the lock, which
+ * mm_replay replays on a single thread. MM_TRACE must name a file that
+ * does not exist yet: a process only records if it created the trace,
+ * so programs it runs with the same environment record nothing, and
+ * neither does a forked child. A wrapper script that execs the program
+ * would record nothing itself, so the program has to be started directly.
+ *
+ *     gcc -O2 -shared -fPIC bench/mm_record.c -o mm_record.so -ldl -lpthread
+ *     MM_TRACE=prog.trace LD_PRELOAD=./mm_record.so prog
+ */
+
+#define _GNU_SOURCE     // for RTLD_NEXT
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+/*the trace is written in chunks of up to this many bytes*/
+#define OUT_SIZE (1 << 16)
+/*dlsym allocates before the real calloc is known, it gets these bytes*/
+#define BOOT_SIZE 4096
+
+typedef struct slot
+{
+    void *bp;           // NULL if the slot is empty
+    size_t id;
+} slot_t;
+
+static void *(*real_malloc)(size_t size);
+static void *(*real_calloc)(size_t nmemb, size_t size);
+static void *(*real_realloc)(void *bp, size_t size);
+static void (*real_free)(void *bp);
+
+/*lock protects everything below but boot*/
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int trace_fd = -1;
+static char out[OUT_SIZE];
+static size_t out_len = 0;
+/*open addressing table from payload to id, capacity a power of two*/
+static slot_t *table = NULL;
+static size_t table_capacity = 0;
+static size_t table_count = 0;
+/*ids that were freed, handed out again before new ones*/
+static size_t *free_ids = NULL;
+static size_t free_id_count = 0;
+static size_t free_id_capacity = 0;
+static size_t next_id = 0;
+
+static char boot[BOOT_SIZE] __attribute__((aligned(16)));
+static size_t boot_used = 0;
+/*set while a thread looks up the real allocator*/
+static __thread bool busy = false;
+
+static void load_real(void);
+static void lock_for_fork(void);
+static void unlock_for_fork(void);
+static void stop_in_child(void);
+static bool is_boot(void *bp);
+static void record(char request, void *bp, void *old, size_t nmemb, size_t size);
+static void emit(char request, size_t id, size_t nmemb, size_t size);
+static void flush_out(void);
+static slot_t *table_find(void *bp);
+static bool table_grow(void);
+static void table_add(void *bp, size_t id);
+static bool table_remove(void *bp, size_t *id);
+static size_t take_id(void);
+static void give_id(size_t id);
+static void *map_array(void *old, size_t old_bytes, size_t bytes);
+
+/*
+ * load_real: looks up the allocator behind the shim and opens the trace,
+ *     runs before main or at the first request, whichever is first
+ */
+__attribute__((constructor))
+static void load_real(void)
+{
+    const char *path;
+
+    if (real_free != NULL || busy)
+        return;
+    busy = true;
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    busy = false;
+
+    path = getenv("MM_TRACE");
+    if (path == NULL)
+        return;
+    pthread_mutex_lock(&lock);
+    if (trace_fd < 0)
+        trace_fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    pthread_mutex_unlock(&lock);
+    pthread_atfork(lock_for_fork, unlock_for_fork, stop_in_child);
+}
+
+/*helper functions to keep the lock and the buffer whole across fork*/
+static void lock_for_fork(void)
+{
+    pthread_mutex_lock(&lock);
+}
+
+static void unlock_for_fork(void)
+{
+    pthread_mutex_unlock(&lock);
+}
+
+/*helper function for the child of a fork, which writes nothing*/
+static void stop_in_child(void)
+{
+    trace_fd = -1;
+    out_len = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+ * flush_at_exit: writes what is left of the trace
+ */
+__attribute__((destructor))
+static void flush_at_exit(void)
+{
+    pthread_mutex_lock(&lock);
+    flush_out();
+    pthread_mutex_unlock(&lock);
+}
+
+void *malloc(size_t size)
+{
+    void *bp;
+    if (real_malloc == NULL)
+        load_real();
+    if (real_malloc == NULL)
+        return calloc(1, size);     // dlsym itself is looking it up
+    bp = real_malloc(size);
+    record('a', bp, NULL, 0, size);
+    return bp;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *bp;
+    //dlsym asks for memory before real_calloc is set
+    if (real_calloc == NULL)
+    {
+        size_t bytes;
+        if (size != 0 && nmemb > (BOOT_SIZE / size))
+            return NULL;
+        bytes = (nmemb * size + 15) & ~(size_t)15;
+        bp = NULL;
+        if (boot_used + bytes <= BOOT_SIZE)
+        {
+            bp = boot + boot_used;  // boot is static, so still zero
+            boot_used += bytes;
+        }
+        return bp;
+    }
+    bp = real_calloc(nmemb, size);
+    record('c', bp, NULL, nmemb, size);
+    return bp;
+}
+
+void *realloc(void *bp, size_t size)
+{
+    void *new_bp;
+    if (real_realloc == NULL)
+        load_real();
+    /*boot memory is never given to the real allocator*/
+    if (is_boot(bp))
+    {
+        new_bp = real_malloc(size);
+        if (new_bp != NULL)
+        {
+            size_t left = boot + BOOT_SIZE - (char *)bp;
+            memcpy(new_bp, bp, size < left ? size : left);
+        }
+        return new_bp;
+    }
+    new_bp = real_realloc(bp, size);
+    record('r', new_bp, bp, 0, size);
+    return new_bp;
+}
+
+void free(void *bp)
+{
+    if (bp == NULL || is_boot(bp))
+        return;
+    if (real_free == NULL)
+        load_real();
+    //recorded first, another thread may get the same address right after
+    record('f', NULL, bp, 0, 0);
+    real_free(bp);
+}
+
+/*helper function to tell the memory handed to dlsym apart*/
+static bool is_boot(void *bp)
+{
+    return (char *)bp >= boot && (char *)bp < boot + BOOT_SIZE;
+}
+
+/*
+ * record: writes a request to the trace, bp is the payload it returned
+ *     and old the payload it was given
+ */
+static void record(char request, void *bp, void *old, size_t nmemb, size_t size)
+{
+    size_t id;
+
+    if (trace_fd < 0 || busy)
+        return;
+    pthread_mutex_lock(&lock);
+    switch (request)
+    {
+    case 'f':
+        if (table_remove(old, &id))
+        {
+            emit('f', id, 0, 0);
+            give_id(id);
+        }
+        break;
+    case 'r':
+        //a payload the trace does not know becomes a new one
+        if (old == NULL || !table_remove(old, &id))
+        {
+            if (bp == NULL)
+                break;
+            id = take_id();
+        }
+        else if (bp == NULL && size != 0)
+        {
+            //a failed realloc keeps the old payload
+            table_add(old, id);
+            break;
+        }
+        emit('r', id, 0, size);
+        if (bp != NULL)
+            table_add(bp, id);
+        else
+            give_id(id);
+        break;
+    default:
+        if (bp == NULL)
+            break;
+        id = take_id();
+        table_add(bp, id);
+        emit(request, id, nmemb, size);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/*helper function to append one request line to the output buffer*/
+static void emit(char request, size_t id, size_t nmemb, size_t size)
+{
+    int len;
+
+    if (out_len + 80 > OUT_SIZE)
+        flush_out();
+    if (request == 'c')
+        len = snprintf(out + out_len, 80, "c %zu %zu %zu\n", id, nmemb, size);
+    else if (request == 'f')
+        len = snprintf(out + out_len, 80, "f %zu\n", id);
+    else
+        len = snprintf(out + out_len, 80, "%c %zu %zu\n", request, id, size);
+    out_len += len;
+}
+
+/*helper function to write the output buffer to the trace*/
+static void flush_out(void)
+{
+    size_t done = 0;
+    while (trace_fd >= 0 && done < out_len)
+    {
+        ssize_t n = write(trace_fd, out + done, out_len - done);
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    out_len = 0;
+}
+
+/*helper function to return the table slot of bp, or the empty one it would go in*/
+static slot_t *table_find(void *bp)
+{
+    size_t mask = table_capacity - 1;
+    size_t i = ((uintptr_t)bp >> 4) * 0x9e3779b97f4a7c15ULL >> 20 & mask;
+
+    while (table[i].bp != NULL && table[i].bp != bp)
+        i = (i + 1) & mask;
+    return &table[i];
+}
+
+/*helper function to double the table, false if out of memory*/
+static bool table_grow(void)
+{
+    size_t old_capacity = table_capacity;
+    slot_t *old = table;
+    slot_t *new_table;
+
+    table_capacity = (old_capacity != 0) ? 2 * old_capacity : 4096;
+    new_table = map_array(NULL, 0, table_capacity * sizeof(slot_t));
+    if (new_table == NULL)
+    {
+        table_capacity = old_capacity;
+        return false;
+    }
+    table = new_table;
+    for (size_t i = 0; i < old_capacity; i++)
+        if (old[i].bp != NULL)
+            *table_find(old[i].bp) = old[i];
+    if (old != NULL)
+        munmap(old, old_capacity * sizeof(slot_t));
+    return true;
+}
+
+/*helper function to map a live payload to its id*/
+static void table_add(void *bp, size_t id)
+{
+    slot_t *slot;
+
+    //kept at most half full so that probes stay short
+    if (2 * (table_count + 1) > table_capacity && !table_grow())
+        return;
+    slot = table_find(bp);
+    if (slot->bp == NULL)
+        table_count++;
+    slot->bp = bp;
+    slot->id = id;
+}
+
+/*
+ * table_remove: takes bp out of the table, false if it was not in it.
+ *     the slots after it move back so that no probe sequence is broken
+ */
+static bool table_remove(void *bp, size_t *id)
+{
+    size_t mask = table_capacity - 1;
+    slot_t *slot;
+    size_t hole, i;
+
+    if (table_capacity == 0)
+        return false;
+    slot = table_find(bp);
+    if (slot->bp == NULL)
+        return false;
+    *id = slot->id;
+    table_count--;
+
+    hole = slot - table;
+    for (i = (hole + 1) & mask; table[i].bp != NULL; i = (i + 1) & mask)
+    {
+        size_t home = ((uintptr_t)table[i].bp >> 4) * 0x9e3779b97f4a7c15ULL >> 20 & mask;
+        //the slot may move to the hole if its home is not between them
+        if (((i - home) & mask) >= ((i - hole) & mask))
+        {
+            table[hole] = table[i];
+            hole = i;
+        }
+    }
+    table[hole].bp = NULL;
+    return true;
+}
+
+/*helper function to return the smallest id that is not in use*/
+static size_t take_id(void)
+{
+    if (free_id_count == 0)
+        return next_id++;
+    //free_ids is a min-heap, so the lowest id comes out first
+    size_t id = free_ids[0];
+    size_t last = free_ids[--free_id_count];
+    size_t i = 0;
+    for (;;)
+    {
+        size_t child = 2 * i + 1;
+        if (child >= free_id_count)
+            break;
+        if (child + 1 < free_id_count && free_ids[child + 1] < free_ids[child])
+            child++;
+        if (free_ids[child] >= last)
+            break;
+        free_ids[i] = free_ids[child];
+        i = child;
+    }
+    if (free_id_count != 0)
+        free_ids[i] = last;
+    return id;
+}
+
+/*helper function to put an id back in the min-heap of free ids*/
+static void give_id(size_t id)
+{
+    size_t i;
+
+    if (free_id_count == free_id_capacity)
+    {
+        size_t capacity = (free_id_capacity != 0) ? 2 * free_id_capacity : 4096;
+        size_t *ids = map_array(free_ids, free_id_capacity * sizeof(size_t),
+                                capacity * sizeof(size_t));
+        if (ids == NULL)
+            return;     // the id is just never used again
+        free_ids = ids;
+        free_id_capacity = capacity;
+    }
+    for (i = free_id_count++; i > 0 && free_ids[(i - 1) / 2] > id; i = (i - 1) / 2)
+        free_ids[i] = free_ids[(i - 1) / 2];
+    free_ids[i] = id;
+}
+
+/*
+ * map_array: returns bytes of zeroed memory that keep the old_bytes at
+ *     old, straight from mmap so that the shim never calls itself.
+ *     NULL if out of memory, old is still valid then
+ */
+static void *map_array(void *old, size_t old_bytes, size_t bytes)
+{
+    void *array;
+    if (old == NULL)
+        array = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    else
+        array = mremap(old, old_bytes, bytes, MREMAP_MAYMOVE);
+    return (array == MAP_FAILED) ? NULL : array;
+}
@@ -0,0 +1,345 @@
+/*
+ ******************************************************************************
+ *                               mm_replay.c                                  *
+ *        Replays allocation traces against mm.c and reports how it did       *
+ *                 CSE 361: Introduction to Computer Systems                  *
+ ******************************************************************************
+ */
+
+/*
+ * A trace has one request per line, ids name payloads:
+ *
+ *     a <id> <size>            malloc
+ *     c <id> <nmemb> <size>    calloc
+ *     r <id> <size>            realloc, of NULL if id is not allocated
+ *     f <id>                   free
+ *
+ * blank lines and lines starting with # are skipped. mm_record.so writes
+ * this format from a running program.
+ *
+ * Every trace is replayed twice from a fresh heap. The first pass only
+ * times the whole trace for the throughput, the second times each request
+ * and reads mm_stats after it for the peak heap size. One JSON object per
+ * trace is printed on its own line:
+ *
+ *     {"trace": ..., "ops": ..., "failed": ..., "ops_per_sec": ...,
+ *      "latency_ns": {"p50": ..., "p99": ..., "p999": ..., "max": ...},
+ *      "peak_heap_bytes": ..., "peak_live_bytes": ..., "utilization": ...,
+ *      "fit_searches": ..., "fit_probes": ..., "probes_per_search": ...}
+ *
+ * peak_heap_bytes counts the heaps and the mmap blocks, peak_live_bytes
+ * the bytes the trace asked for, and utilization is the second over the
+ * first. failed counts requests that returned NULL.
+ *
+ * Build with the mm.h and memlib.c of the course handout:
+ *     gcc -O2 -DDRIVER -I. mm.c memlib.c bench/mm_replay.c -o mm_replay -lpthread
+ * usage: mm_replay trace...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "mm_ext.h"
+
+typedef struct op
+{
+    char type;          // a, c, r or f
+    size_t id;
+    size_t nmemb;       // only used by calloc
+    size_t size;
+} op_t;
+
+typedef struct trace
+{
+    op_t *ops;
+    size_t count;
+    size_t id_count;    // every id is below this
+} trace_t;
+
+typedef struct result
+{
+    size_t failed;
+    double seconds;
+    uint64_t *latency;  // ns of each request, second pass only
+    size_t peak_heap;
+    size_t peak_live;
+    size_t fit_searches;
+    size_t fit_probes;
+} result_t;
+
+static bool read_trace(const char *path, trace_t *trace);
+static void run_trace(const trace_t *trace, result_t *result, bool measure);
+static uint64_t now_ns(void);
+static int compare_u64(const void *a, const void *b);
+static uint64_t percentile(const uint64_t *sorted, size_t count, double p);
+static void print_result(const char *path, const trace_t *trace,
+                         const result_t *result);
+
+int main(int argc, char **argv)
+{
+    int status = 0;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s trace...\n", argv[0]);
+        return 2;
+    }
+    mem_init();
+    for (int i = 1; i < argc; i++)
+    {
+        trace_t trace;
+        result_t result;
+
+        if (!read_trace(argv[i], &trace))
+        {
+            status = 1;
+            continue;
+        }
+        memset(&result, 0, sizeof(result));
+        result.latency = malloc(trace.count * sizeof(uint64_t) + 1);
+        if (result.latency == NULL)
+        {
+            fprintf(stderr, "%s: out of memory\n", argv[i]);
+            free(trace.ops);
+            status = 1;
+            continue;
+        }
+        run_trace(&trace, &result, false);
+        run_trace(&trace, &result, true);
+        print_result(argv[i], &trace, &result);
+        free(result.latency);
+        free(trace.ops);
+    }
+    mem_deinit();
+    return status;
+}
+
+/*
+ * read_trace: reads the requests of the trace at path,
+ *     returns false after printing why if it cannot
+ */
+static bool read_trace(const char *path, trace_t *trace)
+{
+    FILE *file = fopen(path, "r");
+    char line[256];
+    size_t capacity = 0;
+    size_t lineno = 0;
+
+    if (file == NULL)
+    {
+        perror(path);
+        return false;
+    }
+    trace->ops = NULL;
+    trace->count = 0;
+    trace->id_count = 0;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        op_t op = {0};
+        int fields;
+
+        lineno++;
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        op.type = line[0];
+        switch (op.type)
+        {
+        case 'a':
+        case 'r':
+            fields = sscanf(line + 1, "%zu %zu", &op.id, &op.size) == 2;
+            break;
+        case 'c':
+            fields = sscanf(line + 1, "%zu %zu %zu", &op.id, &op.nmemb, &op.size) == 3;
+            break;
+        case 'f':
+            fields = sscanf(line + 1, "%zu", &op.id) == 1;
+            break;
+        default:
+            fields = 0;
+        }
+        if (!fields)
+        {
+            fprintf(stderr, "%s:%zu: bad request\n", path, lineno);
+            goto fail;
+        }
+
+        if (trace->count == capacity)
+        {
+            op_t *ops;
+            capacity = (capacity != 0) ? 2 * capacity : 4096;
+            ops = realloc(trace->ops, capacity * sizeof(op_t));
+            if (ops == NULL)
+            {
+                fprintf(stderr, "%s: out of memory\n", path);
+                goto fail;
+            }
+            trace->ops = ops;
+        }
+        trace->ops[trace->count++] = op;
+        if (op.id >= trace->id_count)
+            trace->id_count = op.id + 1;
+    }
+    fclose(file);
+    return true;
+
+fail:
+    free(trace->ops);
+    fclose(file);
+    return false;
+}
+
+/*
+ * run_trace: replays a trace on a fresh heap. without measure only the
+ *     total time is taken, with it each request is timed and followed by
+ *     a look at the heap size and the live bytes
+ */
+static void run_trace(const trace_t *trace, result_t *result, bool measure)
+{
+    void **payloads = calloc(trace->id_count + 1, sizeof(void *));
+    size_t *sizes = calloc(trace->id_count + 1, sizeof(size_t));
+    size_t live = 0;
+    mm_stats_t before, after;
+    uint64_t start;
+
+    if (payloads == NULL || sizes == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    mem_reset_brk();
+    if (!mm_init())
+    {
+        fprintf(stderr, "mm_init failed\n");
+        exit(1);
+    }
+    mm_stats(&before);
+    result->failed = 0;
+
+    start = now_ns();
+    for (size_t i = 0; i < trace->count; i++)
+    {
+        const op_t *op = &trace->ops[i];
+        uint64_t op_start = measure ? now_ns() : 0;
+        void *bp;
+        size_t size = op->size;
+
+        switch (op->type)
+        {
+        case 'a':
+            bp = mm_malloc(size);
+            break;
+        case 'c':
+            bp = mm_calloc(op->nmemb, size);
+            size *= op->nmemb;
+            break;
+        case 'r':
+            bp = mm_realloc(payloads[op->id], size);
+            break;
+        default:
+            mm_free(payloads[op->id]);
+            bp = NULL;
+            size = 0;
+        }
+        if (measure)
+            result->latency[i] = now_ns() - op_start;
+
+        //a failed realloc keeps the old payload
+        if (bp == NULL && op->type != 'f' && size != 0)
+        {
+            result->failed++;
+            continue;
+        }
+        live += size - sizes[op->id];
+        payloads[op->id] = bp;
+        sizes[op->id] = size;
+
+        if (measure && op->type != 'f')
+        {
+            mm_stats(&after);
+            if (after.heap_bytes + after.mmap_bytes > result->peak_heap)
+                result->peak_heap = after.heap_bytes + after.mmap_bytes;
+            if (live > result->peak_live)
+                result->peak_live = live;
+        }
+    }
+
+    if (!measure)
+        result->seconds = (now_ns() - start) / 1e9;
+    else
+    {
+        mm_stats(&after);
+        result->fit_searches = after.fit_searches - before.fit_searches;
+        result->fit_probes = after.fit_probes - before.fit_probes;
+    }
+    for (size_t id = 0; id < trace->id_count; id++)
+        mm_free(payloads[id]);
+    free(payloads);
+    free(sizes);
+}
+
+/*helper function to read the monotonic clock in ns*/
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*helper function for qsort to order latencies*/
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/*helper function to return the p quantile of sorted, 0 if it is empty*/
+static uint64_t percentile(const uint64_t *sorted, size_t count, double p)
+{
+    size_t index;
+    if (count == 0)
+        return 0;
+    index = (size_t)(p * (count - 1) + 0.5);
+    return sorted[index];
+}
+
+/*
+ * print_result: prints the JSON line of one trace, the string escapes
+ *     only cover what shows up in file names
+ */
+static void print_result(const char *path, const trace_t *trace,
+                         const result_t *result)
+{
+    uint64_t *latency = result->latency;
+    size_t count = trace->count;
+
+    qsort(latency, count, sizeof(uint64_t), compare_u64);
+    printf("{\"trace\": \"");
+    for (const char *c = path; *c != '\0'; c++)
+    {
+        if (*c == '"' || *c == '\\')
+            putchar('\\');
+        putchar(*c);
+    }
+    printf("\", \"ops\": %zu, \"failed\": %zu, \"ops_per_sec\": %.0f, ",
+           count, result->failed,
+           result->seconds > 0 ? count / result->seconds : 0.0);
+    printf("\"latency_ns\": {\"p50\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu}, ",
+           (unsigned long long)percentile(latency, count, 0.50),
+           (unsigned long long)percentile(latency, count, 0.99),
+           (unsigned long long)percentile(latency, count, 0.999),
+           (unsigned long long)(count != 0 ? latency[count - 1] : 0));
+    printf("\"peak_heap_bytes\": %zu, \"peak_live_bytes\": %zu, \"utilization\": %.4f, ",
+           result->peak_heap, result->peak_live,
+           result->peak_heap != 0 ? (double)result->peak_live / result->peak_heap : 0.0);
+    printf("\"fit_searches\": %zu, \"fit_probes\": %zu, \"probes_per_search\": %.3f}\n",
+           result->fit_searches, result->fit_probes,
+           result->fit_searches != 0
+               ? (double)result->fit_probes / result->fit_searches : 0.0);
+}
@@ -0,0 +1,545 @@
+/*
+ ******************************************************************************
+ *                               mm_threads.c                                 *
+ *             Multithreaded scalability benchmarks for malloc/free           *
+ *                 CSE 361: Introduction to Computer Systems                  *
+ ******************************************************************************
+ */
+
+/*
+ * Runs each benchmark at 1, 2, 4, ... threads up to the maximum. Every
+ * thread does the same number of iterations, so perfect scaling keeps
+ * the time flat and doubles the throughput with each step.
+ *
+ *     larson    server churn: every thread replaces random payloads of
+ *               its slot array, and after each of 8 rounds new threads
+ *               take over the arrays and free what the old ones allocated
+ *     prodcons  thread i mallocs into a ring that thread i + 1 frees from
+ *     xmalloc   threads swap batches of payloads for the batch on top of
+ *               a shared stack and free that one, mostly another thread's
+ *     bursts    every thread mallocs 512 payloads of its own size and
+ *               frees them again
+ *
+ * One JSON line per run:
+ *
+ *     {"bench": ..., "allocator": ..., "threads": ..., "ops": ...,
+ *      "seconds": ..., "ops_per_sec": ..., "peak_rss_bytes": ...,
+ *      "cross_free_ns": {"p50": ..., "p99": ..., "p999": ...}}
+ *
+ * ops counts malloc and free calls. peak_rss_bytes is the most resident
+ * memory seen while the run went on, sampled every few milliseconds.
+ * cross_free_ns is the time of the frees of payloads another thread
+ * allocated, null for larson and bursts. At one thread they are local
+ * frees, which gives the number to compare against.
+ *
+ * Build against mm.c, or against the C library for the baseline:
+ *     gcc -O2 -DDRIVER -I. mm.c memlib.c bench/mm_threads.c -o mm_threads -lpthread
+ *     gcc -O2 -DGLIBC_BASELINE bench/mm_threads.c -o mm_threads_glibc -lpthread
+ * usage: mm_threads [-t max_threads] [-n iterations] [bench...]
+ */
+
+#define _GNU_SOURCE     // for sched_yield and sysconf names
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+#ifndef GLIBC_BASELINE
+#include "mm.h"
+#include "memlib.h"
+#endif
+
+#define MAX_THREADS 256
+
+/*payloads of each larson slot array, and larson rounds*/
+static const size_t larson_slots = 1024;
+static const int larson_rounds = 8;
+/*payloads in flight between two prodcons threads*/
+#define RING_SIZE 1024
+/*payloads of an xmalloc batch and of a burst*/
+#define BATCH_SIZE 64
+static const size_t burst_size = 512;
+
+typedef struct thread_arg thread_arg_t;
+
+typedef struct bench
+{
+    const char *name;
+    void *(*worker)(void *arg);
+    bool cross;     // times the frees of other threads' payloads
+} bench_t;
+
+typedef struct ring
+{
+    void *slots[RING_SIZE];
+    size_t head __attribute__((aligned(64)));  // next slot to push, by the producer
+    size_t tail __attribute__((aligned(64)));  // next slot to pop, by the consumer
+} ring_t;
+
+typedef struct batch
+{
+    struct batch *next;
+    void *payloads[BATCH_SIZE];
+} batch_t;
+
+struct thread_arg
+{
+    int index;
+    int threads;
+    long iterations;
+    uint64_t state;         // random numbers
+    void **slots;           // larson slot array
+    uint64_t *latency;      // ns of each cross-thread free
+    size_t latency_count;
+    long ops;
+};
+
+static void *larson_worker(void *arg);
+static void *prodcons_worker(void *arg);
+static void *xmalloc_worker(void *arg);
+static void *bursts_worker(void *arg);
+
+static const bench_t benches[] = {
+    {"larson", larson_worker, false},
+    {"prodcons", prodcons_worker, true},
+    {"xmalloc", xmalloc_worker, true},
+    {"bursts", bursts_worker, false},
+};
+
+static ring_t *rings;
+static pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER;
+static batch_t *batches = NULL;
+static int running = 0;     // workers that have not finished yet
+
+static void *bench_malloc(size_t size);
+static void bench_free(void *bp);
+static void bench_reset(void);
+static void run_bench(const bench_t *bench, int threads, long iterations);
+static size_t run_threads(const bench_t *bench, thread_arg_t *args, int threads);
+static void free_timed(thread_arg_t *arg, void *bp);
+static size_t rss_bytes(void);
+static uint64_t now_ns(void);
+static uint64_t next_random(thread_arg_t *arg);
+static int compare_u64(const void *a, const void *b);
+
+int main(int argc, char **argv)
+{
+    int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    long iterations = 200000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:n:")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            max_threads = atoi(optarg);
+            break;
+        case 'n':
+            iterations = atol(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-t max_threads] [-n iterations] [bench...]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+    if (max_threads < 1)
+        max_threads = 1;
+    if (max_threads > MAX_THREADS)
+        max_threads = MAX_THREADS;
+    rings = calloc(MAX_THREADS, sizeof(ring_t));
+    if (rings == NULL)
+        return 1;
+
+#ifndef GLIBC_BASELINE
+    mem_init();
+#endif
+    for (size_t b = 0; b < sizeof(benches) / sizeof(benches[0]); b++)
+    {
+        bool wanted = (optind == argc);
+        for (int i = optind; i < argc; i++)
+            wanted |= strcmp(argv[i], benches[b].name) == 0;
+        if (!wanted)
+            continue;
+        //1, 2, 4, ... and the maximum itself
+        for (int threads = 1; ; threads *= 2)
+        {
+            if (threads > max_threads)
+                threads = max_threads;
+            run_bench(&benches[b], threads, iterations);
+            if (threads == max_threads)
+                break;
+        }
+    }
+    free(rings);
+    return 0;
+}
+
+/*helper functions to call the allocator under test*/
+static void *bench_malloc(size_t size)
+{
+#ifdef GLIBC_BASELINE
+    return malloc(size);
+#else
+    return mm_malloc(size);
+#endif
+}
+
+static void bench_free(void *bp)
+{
+#ifdef GLIBC_BASELINE
+    free(bp);
+#else
+    mm_free(bp);
+#endif
+}
+
+/*helper function to start each run on a fresh heap, the C library has none*/
+static void bench_reset(void)
+{
+#ifndef GLIBC_BASELINE
+    mem_reset_brk();
+    if (!mm_init())
+    {
+        fprintf(stderr, "mm_init failed\n");
+        exit(1);
+    }
+#endif
+}
+
+/*
+ * run_bench: runs one benchmark at the given thread count and prints
+ *     its JSON line
+ */
+static void run_bench(const bench_t *bench, int threads, long iterations)
+{
+    thread_arg_t args[MAX_THREADS];
+    uint64_t *latency = NULL;
+    size_t latency_count = 0;
+    size_t peak_rss;
+    long ops = 0;
+    uint64_t start;
+    double seconds;
+
+    bench_reset();
+    memset(args, 0, sizeof(args));
+    for (int i = 0; i < threads; i++)
+    {
+        args[i].index = i;
+        args[i].threads = threads;
+        args[i].iterations = iterations;
+        args[i].state = 0x9e3779b97f4a7c15ULL * (i + 1);
+        //the buffers are set up before the clock starts
+        if (bench->cross)
+            args[i].latency = calloc(iterations, sizeof(uint64_t));
+        if (bench->worker == larson_worker)
+            args[i].slots = calloc(larson_slots, sizeof(void *));
+        if ((bench->cross && args[i].latency == NULL)
+            || (bench->worker == larson_worker && args[i].slots == NULL))
+        {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    memset(rings, 0, threads * sizeof(ring_t));
+
+    start = now_ns();
+    if (bench->worker == larson_worker)
+    {
+        //new threads take over the slot arrays after every round
+        peak_rss = 0;
+        for (int round = 0; round < larson_rounds; round++)
+        {
+            size_t rss = run_threads(bench, args, threads);
+            if (rss > peak_rss)
+                peak_rss = rss;
+        }
+    }
+    else
+        peak_rss = run_threads(bench, args, threads);
+    seconds = (now_ns() - start) / 1e9;
+
+    //what is left over is freed outside the timing
+    while (batches != NULL)
+    {
+        batch_t *batch = batches;
+        batches = batch->next;
+        for (int k = 0; k < BATCH_SIZE; k++)
+            bench_free(batch->payloads[k]);
+        bench_free(batch);
+    }
+    for (int i = 0; i < threads; i++)
+    {
+        ops += args[i].ops;
+        if (args[i].slots != NULL)
+            for (size_t k = 0; k < larson_slots; k++)
+                bench_free(args[i].slots[k]);
+        free(args[i].slots);
+        latency_count += args[i].latency_count;
+    }
+
+    printf("{\"bench\": \"%s\", \"allocator\": \"%s\", \"threads\": %d, \"ops\": %ld, "
+           "\"seconds\": %.4f, \"ops_per_sec\": %.0f, \"peak_rss_bytes\": %zu, ",
+           bench->name,
+#ifdef GLIBC_BASELINE
+           "glibc",
+#else
+           "mm",
+#endif
+           threads, ops, seconds, seconds > 0 ? ops / seconds : 0.0, peak_rss);
+    if (bench->cross)
+        latency = malloc(latency_count * sizeof(uint64_t) + 1);
+    if (latency == NULL)
+        printf("\"cross_free_ns\": null}\n");
+    else
+    {
+        size_t n = 0;
+        for (int i = 0; i < threads; i++)
+        {
+            memcpy(latency + n, args[i].latency, args[i].latency_count * sizeof(uint64_t));
+            n += args[i].latency_count;
+        }
+        qsort(latency, n, sizeof(uint64_t), compare_u64);
+        printf("\"cross_free_ns\": {\"p50\": %llu, \"p99\": %llu, \"p999\": %llu}}\n",
+               (unsigned long long)(n ? latency[(size_t)(0.50 * (n - 1))] : 0),
+               (unsigned long long)(n ? latency[(size_t)(0.99 * (n - 1))] : 0),
+               (unsigned long long)(n ? latency[(size_t)(0.999 * (n - 1))] : 0));
+        free(latency);
+    }
+    for (int i = 0; i < threads; i++)
+        free(args[i].latency);
+    fflush(stdout);
+}
+
+/*
+ * run_threads: runs the worker of a benchmark on threads threads and
+ *     returns the peak resident memory seen until they were done
+ */
+static size_t run_threads(const bench_t *bench, thread_arg_t *args, int threads)
+{
+    pthread_t ids[MAX_THREADS];
+    size_t peak = rss_bytes();
+    struct timespec pause = {0, 2000000};
+
+    __atomic_store_n(&running, threads, __ATOMIC_RELAXED);
+    for (int i = 0; i < threads; i++)
+    {
+        if (pthread_create(&ids[i], NULL, bench->worker, &args[i]) != 0)
+        {
+            fprintf(stderr, "pthread_create failed\n");
+            exit(1);
+        }
+    }
+    while (__atomic_load_n(&running, __ATOMIC_ACQUIRE) > 0)
+    {
+        size_t rss = rss_bytes();
+        if (rss > peak)
+            peak = rss;
+        nanosleep(&pause, NULL);
+    }
+    for (int i = 0; i < threads; i++)
+        pthread_join(ids[i], NULL);
+    return peak;
+}
+
+/*
+ * larson_worker: frees a random payload of the slot array and puts a new
+ *     one of 16 to 512 bytes in its place, one round's share of times
+ */
+static void *larson_worker(void *p)
+{
+    thread_arg_t *arg = p;
+    long count = arg->iterations / larson_rounds;
+
+    for (long i = 0; i < count; i++)
+    {
+        uint64_t r = next_random(arg);
+        size_t k = r % larson_slots;
+        bench_free(arg->slots[k]);
+        arg->slots[k] = bench_malloc(16 + (r >> 32) % 497);
+        if (arg->slots[k] != NULL)
+            *(char *)arg->slots[k] = 1;
+    }
+    arg->ops += 2 * count;
+    __atomic_sub_fetch(&running, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/*
+ * prodcons_worker: mallocs iterations payloads of 16 to 256 bytes into
+ *     the ring of the next thread and frees as many from its own ring,
+ *     freeing whenever its ring has something or the next one is full
+ */
+static void *prodcons_worker(void *p)
+{
+    thread_arg_t *arg = p;
+    ring_t *in = &rings[arg->index];
+    ring_t *out = &rings[(arg->index + 1) % arg->threads];
+    long produced = 0;
+    long consumed = 0;
+
+    while (produced < arg->iterations || consumed < arg->iterations)
+    {
+        size_t tail = in->tail;
+        bool progress = false;
+
+        if (consumed < arg->iterations
+            && __atomic_load_n(&in->head, __ATOMIC_ACQUIRE) != tail)
+        {
+            free_timed(arg, in->slots[tail % RING_SIZE]);
+            __atomic_store_n(&in->tail, tail + 1, __ATOMIC_RELEASE);
+            consumed++;
+            progress = true;
+        }
+        if (produced < arg->iterations
+            && out->head - __atomic_load_n(&out->tail, __ATOMIC_ACQUIRE) < RING_SIZE)
+        {
+            void *bp = bench_malloc(16 + next_random(arg) % 241);
+            if (bp != NULL)
+                *(char *)bp = 1;
+            out->slots[out->head % RING_SIZE] = bp;
+            __atomic_store_n(&out->head, out->head + 1, __ATOMIC_RELEASE);
+            produced++;
+            progress = true;
+        }
+        if (!progress)
+            sched_yield();
+    }
+    arg->ops += 2 * arg->iterations;
+    __atomic_sub_fetch(&running, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/*
+ * xmalloc_worker: mallocs a batch of payloads of 8 to 256 bytes, swaps
+ *     it for the batch on top of the shared stack and frees that one,
+ *     until iterations payloads went through
+ */
+static void *xmalloc_worker(void *p)
+{
+    thread_arg_t *arg = p;
+    long count = arg->iterations / BATCH_SIZE;
+
+    for (long i = 0; i < count; i++)
+    {
+        batch_t *batch = bench_malloc(sizeof(batch_t));
+        batch_t *taken;
+        if (batch == NULL)
+            break;
+        for (int k = 0; k < BATCH_SIZE; k++)
+        {
+            batch->payloads[k] = bench_malloc(8 + next_random(arg) % 249);
+            if (batch->payloads[k] != NULL)
+                *(char *)batch->payloads[k] = 1;
+        }
+        arg->ops += BATCH_SIZE + 1;
+
+        //the batch on top is taken in exchange for this one
+        pthread_mutex_lock(&batch_lock);
+        taken = batches;
+        if (taken != NULL)
+            batches = taken->next;
+        batch->next = batches;
+        batches = batch;
+        pthread_mutex_unlock(&batch_lock);
+
+        if (taken == NULL)
+            continue;
+        for (int k = 0; k < BATCH_SIZE; k++)
+            free_timed(arg, taken->payloads[k]);
+        bench_free(taken);
+        arg->ops += BATCH_SIZE + 1;
+    }
+    __atomic_sub_fetch(&running, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/*
+ * bursts_worker: mallocs burst_size payloads of a size that depends on
+ *     the thread and frees them in the same order, until iterations
+ *     payloads went through
+ */
+static void *bursts_worker(void *p)
+{
+    thread_arg_t *arg = p;
+    void *burst[512];
+    size_t size = 16 * (1 + (arg->index * 7) % 32);
+    long count = arg->iterations / burst_size;
+
+    for (long i = 0; i < count; i++)
+    {
+        for (size_t k = 0; k < burst_size; k++)
+        {
+            burst[k] = bench_malloc(size);
+            if (burst[k] != NULL)
+                *(char *)burst[k] = 1;
+        }
+        for (size_t k = 0; k < burst_size; k++)
+            bench_free(burst[k]);
+    }
+    arg->ops += 2 * count * burst_size;
+    __atomic_sub_fetch(&running, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/*helper function to free a payload some thread allocated and time it*/
+static void free_timed(thread_arg_t *arg, void *bp)
+{
+    uint64_t start = now_ns();
+    bench_free(bp);
+    if (arg->latency_count < (size_t)arg->iterations)
+        arg->latency[arg->latency_count++] = now_ns() - start;
+}
+
+/*helper function to read the resident bytes of the process*/
+static size_t rss_bytes(void)
+{
+    char buf[128];
+    unsigned long size = 0, resident = 0;
+    int fd = open("/proc/self/statm", O_RDONLY);
+    ssize_t n;
+
+    if (fd < 0)
+        return 0;
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0)
+        return 0;
+    buf[n] = '\0';
+    if (sscanf(buf, "%lu %lu", &size, &resident) != 2)
+        return 0;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+/*helper function to read the monotonic clock in ns*/
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*helper function to return the next xorshift64 number of a thread*/
+static uint64_t next_random(thread_arg_t *arg)
+{
+    arg->state ^= arg->state << 13;
+    arg->state ^= arg->state >> 7;
+    arg->state ^= arg->state << 17;
+    return arg->state;
+}
+
+/*helper function for qsort to order latencies*/
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
@@ -1,7 +1,7 @@
 /*
  ******************************************************************************
  *                               mm.c                                         *
- *           64-bit struct-based explicit free list memory allocator          *
+ *         64-bit struct-based segregated free list memory allocator          *
  *                      with coalesce functionality                           *
  *                 CSE 361: Introduction to Computer Systems                  *
  *                                                                            *
@@ -11,16 +11,29 @@
  ******************************************************************************
  */
 
+#define _GNU_SOURCE     // for mremap
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <assert.h>
+#include <errno.h>
 #include <stddef.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <execinfo.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "mm.h"
 #include "memlib.h"
+#include "mm_ext.h"
+#include "mm_fast.h"
 
 #ifdef DRIVER
 /* create aliases for driver tests */
@@ -59,12 +72,239 @@ typedef uint64_t word_t;
 static const size_t wsize = sizeof(word_t);   // word and header size (bytes)
 static const size_t dsize = 2*sizeof(word_t);       // double word size (bytes)
 static const size_t min_block_size = 4*sizeof(word_t); // Minimum block size
-static const size_t chunksize = (1 << 12);    // requires (chunksize % 16 == 0)
 
 static const word_t alloc_mask = 0x1;
 static const word_t prev_alloc_mask = 0x2;    //set the prev_alloc bit mask
+static const word_t mmap_mask = 0x4;    //set on blocks that are their own mmap region
+static const word_t sampled_mask = 0x8; //set on allocated blocks the profiler samples
+/*set on free blocks whose inner pages were given back, mmap blocks are never free*/
+static const word_t decommit_mask = 0x4;
 static const word_t size_mask = ~(word_t)0xF;
 
+/*
+ * Requests up to slab_max_size bytes are served from slab pages: blocks of
+ * slab_page_size bytes whose payload is aligned to slab_page_size and is
+ * cut into equal slots without any per-slot header. There is one slab
+ * class per multiple of dsize.
+ */
+static const size_t slab_max_size = MM_FAST_MAX_SIZE;
+static const size_t slab_page_size = (1 << 12);
+#define SLAB_CLASS_COUNT MM_FAST_CLASS_COUNT
+#define SLAB_MAP_WORDS 4    // enough bits for the slots of the 16 byte class
+
+/*
+ * Each thread caches up to tcache_bin_max freed slots per slab class.
+ * An empty bin is refilled with tcache_batch slots under the arena lock,
+ * and a full bin gives half of its slots back in one go.
+ */
+static const uint32_t tcache_bin_max = 32;
+static const uint32_t tcache_batch = 16;
+
+/*
+ * Threads are spread round-robin over ARENA_COUNT arenas, each with its
+ * own heap, freelists, slab pages and lock. Arena 0 grows with mem_sbrk;
+ * the others grow inside their own arena_reserve_size slice of one
+ * address range reserved with mmap, slice i belonging to arena i.
+ *
+ * In hugepage mode (MM_OPT_HUGEPAGE) arena 0 uses slice 0 as well, and
+ * every slice is committed, advised with MADV_HUGEPAGE and trimmed in
+ * huge_page_size steps, so that the kernel can back heaps with 2 MiB
+ * pages and trimming never splits one. The slices are huge page aligned.
+ */
+#define ARENA_COUNT 8
+static const size_t arena_reserve_size = (size_t)1 << 36;
+static const size_t huge_page_size = (size_t)1 << 21;
+
+/*
+ * A payload freed by a thread of another arena is queued for its owner.
+ * Once more than remote_drain_min are queued, the thread that queues
+ * the next one drains them itself if it gets the owner's lock right
+ * away, so an idle owner cannot pile up memory.
+ */
+static const size_t remote_drain_min = 256;
+
+/*
+ * In deferred coalescing mode (MM_OPT_DEFER_COALESCE) a freed block of
+ * at most quick_max_size bytes keeps its alloc bit and goes to the quick
+ * bin of its size, from where a malloc of exactly that size takes it
+ * back without touching any neighbor. The bins are coalesced all at once
+ * when find_fit misses or quick_max_count blocks are waiting.
+ */
+static const size_t quick_max_size = 1024;
+#define QUICK_BIN_COUNT 65      // one bin per dsize step up to quick_max_size
+static const uint32_t quick_max_count = 256;
+
+/*
+ * A region bump-allocates inside chunks it takes from malloc. The first
+ * chunk has region_chunk_min bytes and each new one is twice as big as
+ * the last, up to region_chunk_max.
+ */
+static const size_t region_chunk_min = (size_t)16 << 10;
+static const size_t region_chunk_max = (size_t)1 << 20;
+
+/*
+ * Requests of at least mmap_threshold bytes get their own mmap region,
+ * so freeing them gives the memory back to the OS right away.
+ * The word in front of the header holds the offset of the payload from
+ * the start of the region, and the header size is the region length.
+ */
+static const size_t mmap_default_threshold = (size_t)128 << 10;
+static const size_t page_size = (1 << 12);
+
+/*
+ * A free block of at least trim_threshold bytes that ends the heap is
+ * given back to the OS, except for as much as the next extension would
+ * add, so that a heap does not keep growing and shrinking. mmap arenas
+ * lower their break, arena 0 cannot shrink the mem_sbrk heap, so it
+ * releases the pages inside the block instead.
+ */
+static const size_t trim_default_threshold = (size_t)128 << 10;
+
+/*
+ * Zero fills and copies of at least nontemporal_min bytes use streaming
+ * stores where SSE2 is available, so a big calloc or realloc does not
+ * push the rest of the working set out of the cache.
+ */
+static const size_t nontemporal_min = (size_t)64 << 10;
+
+/*
+ * In sampling mode (MM_OPT_SAMPLE_INTERVAL) each thread counts down the
+ * bytes it allocates, and the request that takes the count below zero
+ * is sampled. The gaps are drawn from an exponential distribution with
+ * the interval as mean, so every byte is equally likely to be sampled.
+ * A sampled request always gets a block, whose header has the sampled
+ * bit, and a record with its call stack in a hash table by payload.
+ * With sampling off a thread looks at the interval again every
+ * sample_recheck bytes.
+ */
+#define SAMPLE_MAX_DEPTH 32
+#define SAMPLE_TABLE_SIZE (1 << 14)
+static const size_t sample_recheck = (size_t)1 << 20;
+static const size_t sample_chunk_size = (size_t)64 << 10;
+
+/*
+ * In guard mode (MM_OPT_GUARD_INTERVAL) each thread counts down its
+ * mallocs as well, and about one in the interval of those up to
+ * page_size bytes takes a page of the guard pool. The pool has
+ * GUARD_SLOT_COUNT pages with a PROT_NONE page after each, and the
+ * payload ends as close to that page as the alignment allows. A freed
+ * page is made PROT_NONE too and goes behind every other free page, so
+ * it is reused last. A guarded request that finds no free page is
+ * served as usual. With guard mode off a thread looks at the interval
+ * again every guard_recheck mallocs.
+ */
+#define GUARD_SLOT_COUNT 256
+static const size_t guard_recheck = (size_t)1 << 12;
+//one guard page in front of the first slot page and one after each
+static const size_t guard_pool_size = (2 * GUARD_SLOT_COUNT + 1) * (1 << 12);
+
+/*
+ * The tuning of the allocator is fixed at compile time, so the compiler
+ * folds every field into the code that reads it. If POLICY_LATENCY is
+ * defined, searches, splits and heap extensions are traded for memory;
+ * if POLICY_MEMORY is defined, it is the other way round.
+ *     fit_probes: fits the nth fit search compares before taking the best
+ *     split_min: a placed block is only split if at least this much is
+ *         left, at least min_block_size
+ *     chunksize: the first heap extension and the smallest later one,
+ *         a multiple of dsize
+ * A heap that runs out of free blocks grows by growth_percent of its
+ * current size, at least chunksize and at most growth_max bytes, so a
+ * big heap is built in a few extensions instead of one per chunk.
+ * Extensions of at least prefault_min bytes have their pages faulted in
+ * right away rather than by the first mallocs that touch them. All three
+ * are the defaults of their mm_mallopt options.
+ */
+typedef struct policy
+{
+    int fit_probes;
+    size_t split_min;
+    size_t chunksize;
+    size_t growth_percent;
+    size_t growth_max;
+    size_t prefault_min;
+} policy_t;
+
+//#define POLICY_LATENCY // uncomment this line to tune for latency
+//#define POLICY_MEMORY // uncomment this line to tune for memory
+
+#if defined(POLICY_LATENCY) && defined(POLICY_MEMORY)
+#error "POLICY_LATENCY and POLICY_MEMORY are different tunings"
+#endif
+
+#if defined(POLICY_LATENCY)
+static const policy_t policy = {
+    .fit_probes = 8,
+    .split_min = 8*sizeof(word_t),
+    .chunksize = (size_t)1 << 16,
+    .growth_percent = 50,
+    .growth_max = (size_t)16 << 20,
+    .prefault_min = (size_t)256 << 10,
+};
+#elif defined(POLICY_MEMORY)
+static const policy_t policy = {
+    .fit_probes = 200,
+    .split_min = 4*sizeof(word_t),
+    .chunksize = (size_t)1 << 12,
+    .growth_percent = 10,
+    .growth_max = (size_t)1 << 20,
+    .prefault_min = (size_t)4 << 20,
+};
+#else
+static const policy_t policy = {
+    .fit_probes = 50,
+    .split_min = 4*sizeof(word_t),
+    .chunksize = (size_t)1 << 12,
+    .growth_percent = 25,
+    .growth_max = (size_t)4 << 20,
+    .prefault_min = (size_t)1 << 20,
+};
+#endif
+
+/*
+ * If TLSF is defined, free blocks are kept by the two-level segregated fit
+ * engine, which makes find_fit O(1). If BEST_FIT_TREE is defined, each
+ * power-of-two class is a treap ordered by (size, address) instead of a
+ * list, which makes find_fit an O(log n) address-ordered best fit.
+ * If DENSE_INDEX is defined, each class is an array of (size, block)
+ * entries, so the nth fit search reads sizes from contiguous memory and
+ * only touches the block it picks.
+ * Otherwise the nth fit policy searches power-of-two segregated lists.
+ */
+//#define TLSF // uncomment this line to use the TLSF engine
+//#define BEST_FIT_TREE // uncomment this line to use the best fit trees
+//#define DENSE_INDEX // uncomment this line to use the dense class arrays
+
+#if defined(TLSF) + defined(BEST_FIT_TREE) + defined(DENSE_INDEX) > 1
+#error "TLSF, BEST_FIT_TREE and DENSE_INDEX are different free block engines"
+#endif
+
+#ifdef TLSF
+/*
+ * Each first-level list covers one power of two and is split into
+ * (1 << TLSF_SL_LOG2) second-level lists of equal width. Sizes below
+ * tlsf_small_size all share first-level list 0 in steps of dsize.
+ */
+#define TLSF_SL_LOG2 4
+#define TLSF_SL_COUNT (1 << TLSF_SL_LOG2)
+#define TLSF_FL_COUNT 41    // sizes up to 2^48 bytes
+#define FREELIST_COUNT (TLSF_FL_COUNT * TLSF_SL_COUNT)
+static const size_t tlsf_small_size = (size_t)1 << (TLSF_SL_LOG2 + 4);
+static const size_t tlsf_max_size = (size_t)1 << (TLSF_FL_COUNT + TLSF_SL_LOG2 + 3);
+#else
+/*
+ * Number of segregated free lists. List i holds free blocks whose size is
+ * in [min_block_size << i, min_block_size << (i+1)); the last list holds
+ * every block that is too big for the others. With BEST_FIT_TREE,
+ * freelist_start[i] is the root of the tree of class i and the prev and
+ * next links of a free block are its left and right children. With
+ * DENSE_INDEX, class i is dense_index[i] and the prev link of a free
+ * block holds its position in that array.
+ */
+#define SEG_LIST_COUNT 15
+#define FREELIST_COUNT SEG_LIST_COUNT
+#endif
+
 typedef struct block
 {
     /* Header contains size + allocation flag */
@@ -88,30 +328,347 @@ typedef struct block
      */
 } block_t;
 
+#ifdef DENSE_INDEX
+typedef struct dense_entry
+{
+    size_t size;        // copy of the block size, read by find_fit
+    block_t *block;
+} dense_entry_t;
+
+typedef struct dense_index
+{
+    /* mmap'd array, grown with mremap, never shrunk */
+    dense_entry_t *entries;
+    uint32_t count;
+    uint32_t capacity;
+} dense_index_t;
+
+/*position a free block gets if its array cannot grow, it is then only
+    reused once it coalesces with a neighbor*/
+static const uintptr_t dense_unindexed = (uintptr_t)-1;
+#endif
+
+typedef struct slab
+{
+    /* Links the slab into the partial list of its class */
+    struct slab *prev;
+    struct slab *next;
+    uint32_t slot_size;     // bytes in each slot
+    uint32_t slot_count;    // number of slots in the page
+    uint32_t free_count;    // number of slots that are free
+    uint32_t class_index;   // index into slab_partial
+    word_t free_map[SLAB_MAP_WORDS];  // bit i is set when slot i is free
+    /* The slots start right after the slab header */
+    char slots[0];
+} slab_t;
+
+/*
+ * The thread cache and its counters are declared in mm_fast.h, so that
+ * the inline fast path there can pop cached slots without a call
+ */
+typedef mm_thread_stats_t thread_stats_t;
+typedef mm_tcache_t tcache_t;
+
+/*
+ * Counters of one arena, written under its lock. The byte counts follow
+ * the free index and the quick bins, the rest only go up.
+ */
+typedef struct arena_stats
+{
+    size_t free_bytes;      // bytes of the blocks in the free index
+    size_t quick_bytes;     // bytes of the blocks in the quick bins
+    size_t fit_searches;
+    size_t fit_probes;
+    size_t splits;
+    size_t coalesces;
+    size_t extends;
+} arena_stats_t;
+
+
+typedef struct arena
+{
+    /* lock protects everything in the arena but remote_frees */
+    pthread_mutex_t lock;
+    /* Pointer to first block, NULL until the arena is first used */
+    block_t *heap_start;
+    /*declare a start for each segregated free list*/
+    block_t *freelist_start[FREELIST_COUNT];
+#ifdef TLSF
+    /*bit f is set exactly when tlsf_sl_bitmap[f] is not 0*/
+    word_t tlsf_fl_bitmap;
+    /*bit s of entry f is set exactly when list (f, s) is not empty*/
+    uint32_t tlsf_sl_bitmap[TLSF_FL_COUNT];
+#else
+    /*bit i is set exactly when freelist_start[i] is not empty*/
+    word_t seg_list_bitmap;
+#endif
+#ifdef DENSE_INDEX
+    /*the free blocks of each class, freelist_start is unused*/
+    dense_index_t dense_index[SEG_LIST_COUNT];
+#endif
+    /*freed blocks of size i * dsize that still look allocated*/
+    block_t *quick_bins[QUICK_BIN_COUNT];
+    uint32_t quick_count;   // blocks in all quick bins
+    /*slab pages of each class that still have a free slot*/
+    slab_t *slab_partial[SLAB_CLASS_COUNT];
+    /*
+     * bit i of slab_pagemap[1 + i / 64] is set when the heap page
+     * slab_base_page + i holds a slab, which is how free tells headerless
+     * slots apart from blocks. slab_pagemap[0] is the number of bits.
+     * The map itself lives in an ordinary allocated block and is read
+     * without the lock, so maps that got replaced are never freed.
+     */
+    word_t *slab_pagemap;
+    uintptr_t slab_base_page;
+    /*
+     * lock-free stack of payloads freed by threads of other arenas,
+     * linked through their first word and freed by this arena's next
+     * locked malloc or free. any thread pushes, only the lock holder
+     * takes them off.
+     */
+    void *remote_frees;
+    size_t remote_count;    // payloads in remote_frees, changed atomically
+    /* The mmap slice the heap grows in, unused by arena 0 */
+    char *region_start;
+    char *region_brk;
+    char *region_committed;    // pages below this are read/write
+    /*the heap was set up in hugepage mode, so it lives in slice 0 too*/
+    bool huge;
+    /*
+     * the pages of the last block of arena 0 from here up to its footer
+     * were released by a trim, NULL once the block is allocated again
+     */
+    char *top_released;
+    /*
+     * every byte from here up to the footer of the free block that ends
+     * the heap is still zero from the OS, NULL if nothing is known to
+     * be. only mmap slices are zero when the heap grows into them.
+     * frees merge with the block from below and only write its header,
+     * links and footer, so they never make this wrong.
+     */
+    char *zero_from;
+    /*set by place when it hands out zero memory, calloc clears it first*/
+    block_t *zero_alloc;
+    char *zero_alloc_from;  // the block is zero from here on
+    arena_stats_t stats;
+    /*
+     * the block check_arena_step goes on from, NULL to start at the
+     * first block. a merge that swallows it moves it to the start of
+     * the merged block, so it is always the header of a block.
+     */
+    block_t *check_cursor;
+} arena_t;
+
+typedef struct sample
+{
+    /* Next record of the same hash bucket, or of the unused records */
+    struct sample *next;
+    void *bp;
+    size_t size;        // bytes asked for
+    int depth;          // frames in stack
+    void *stack[SAMPLE_MAX_DEPTH];
+} sample_t;
+
+typedef struct region_chunk
+{
+    /* The chunk used after this one, kept in order across resets */
+    struct region_chunk *next;
+    char *end;      // end of the chunk
+    /* Payloads are carved from here on */
+    char data[0];
+} region_chunk_t;
+
+struct mm_region
+{
+    region_chunk_t *first;
+    region_chunk_t *current;    // chunk the next payload is carved from
+    char *cursor;               // next free byte of current
+    size_t chunk_size;          // size of the next new chunk
+};
+
 
 /* Global variables */
-/* Pointer to first block */
-static block_t *heap_start = NULL;
-static block_t *freelist_start;  /*declare a start for the explicit free list*/
+static arena_t arenas[ARENA_COUNT] = {
+    [0 ... ARENA_COUNT - 1] = {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+    }
+};
+/*address range holding the heaps of arenas 1 to ARENA_COUNT - 1*/
+static char *arena_region = NULL;
+static pthread_once_t arena_region_once = PTHREAD_ONCE_INIT;
+/*the next arena handed to a thread that allocates for the first time*/
+static unsigned int arena_next = 0;
+static __thread arena_t *thread_arena = NULL;
+/*changed by mm_mallopt, read without any lock*/
+static size_t mmap_threshold = mmap_default_threshold;
+static size_t trim_threshold = trim_default_threshold;
+static size_t growth_percent = policy.growth_percent;
+static size_t growth_max = policy.growth_max;
+static size_t prefault_min = policy.prefault_min;
+/*free puts small blocks in the quick bins*/
+static bool defer_coalesce = false;
+/*heaps set up from now on use hugepage mode*/
+static bool hugepage_mode = false;
+
+/*bumped by mm_init so thread caches drop slots of an older heap*/
+unsigned long mm_heap_generation = 0;
+__thread tcache_t mm_tcache;
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+/*stats_lock protects the list of live thread caches and the counters
+    of threads that exited*/
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static tcache_t *stats_threads = NULL;
+static thread_stats_t stats_exited;
+/*bytes of all mmap blocks, changed with atomic adds*/
+static size_t mmap_bytes = 0;
+/*sample_lock protects the table of live samples and the unused records*/
+static size_t sample_interval = 0;
+static pthread_mutex_t sample_lock = PTHREAD_MUTEX_INITIALIZER;
+static sample_t **sample_table = NULL;     // mmap'd on the first sample
+static sample_t *sample_unused = NULL;
+/*guard_lock protects the free pages of the guard pool and the sizes*/
+static size_t guard_interval = 0;
+static pthread_mutex_t guard_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t guard_pool_once = PTHREAD_ONCE_INIT;
+static char *guard_pool = NULL;     // mmap'd on the first guarded malloc
+static size_t guard_sizes[GUARD_SLOT_COUNT];    // 0 for a free page
+static uint32_t guard_free_slots[GUARD_SLOT_COUNT];  // a ring, oldest first
+static size_t guard_free_head = 0;
+static size_t guard_free_count = 0;
+/*blocks checked by each malloc and free that takes an arena lock*/
+static size_t check_blocks_per_op = 0;
 
 bool mm_checkheap(int lineno);
 //checkheap helper functions
-void mm_printheap();
-void mm_printfreelist();
-bool check_freeblock_coalesce();
-bool check_prev_alloc();
-bool check_all_freeblocks_in_freelist();
-bool check_if_size_smaller_than_minsize();
-bool check_freelist_correctly_linked();
-bool check_alloc_block_overlap();
-bool check_pointer_valid();
+void mm_printheap(arena_t *arena);
+void mm_printfreelist(arena_t *arena);
+bool check_arena(arena_t *arena, int line);
+bool check_arena_step(arena_t *arena, size_t budget, int line);
+bool check_blocks(arena_t *arena, block_t **cursor, size_t budget,
+                  size_t *free_count, size_t *free_bytes);
+bool check_free_links(arena_t *arena, block_t *block);
+bool check_all_freeblocks_in_freelist(arena_t *arena, size_t count);
+bool check_freelist_correctly_linked(arena_t *arena);
+bool check_freeblock_in_right_list(arena_t *arena);
+bool check_list_bitmap(arena_t *arena);
+bool check_slab_pages(arena_t *arena);
+bool check_quick_bins(arena_t *arena);
+bool check_stats(arena_t *arena, size_t free_bytes);
+#ifdef BEST_FIT_TREE
+int check_tree(block_t *root, int index);
+void mm_printtree(block_t *root);
+#endif
 /* Function prototypes for internal helper routines */
-static block_t *extend_heap(size_t size);
-static void place(block_t *block, size_t asize);
-static block_t *find_fit(size_t asize);
-static block_t *coalesce(block_t *block);
+static block_t *extend_heap(arena_t *arena, size_t size);
+static size_t get_extend_size(arena_t *arena, size_t asize);
+static void place(arena_t *arena, block_t *block, size_t asize);
+static size_t place_batch(arena_t *arena, block_t *block, size_t asize,
+                          size_t n, void **out);
+static int compare_address(const void *a, const void *b);
+static block_t *find_fit(arena_t *arena, size_t asize);
+#if !defined(TLSF) && !defined(BEST_FIT_TREE) && !defined(DENSE_INDEX)
+static block_t *find_fit_in_list(arena_t *arena, block_t *start, size_t asize);
+#endif
+#ifdef DENSE_INDEX
+static bool dense_grow(dense_index_t *dense);
+static block_t *find_fit_in_array(arena_t *arena, dense_index_t *dense, size_t asize);
+#endif
+#ifdef BEST_FIT_TREE
+static bool tree_less(block_t *a, block_t *b);
+static word_t tree_priority(block_t *block);
+#endif
+static block_t *coalesce(arena_t *arena, block_t *block);
+static void check_cursor_merged(arena_t *arena, block_t *block, size_t size);
+static void check_on_op(arena_t *arena);
+static block_t *alloc_block(arena_t *arena, size_t asize);
+static block_t *alloc_aligned_block(arena_t *arena, size_t asize, size_t align);
+static void free_block(arena_t *arena, block_t *block);
+static void release_block(arena_t *arena, block_t *block);
+static bool quick_free(arena_t *arena, block_t *block);
+static block_t *quick_alloc(arena_t *arena, size_t asize);
+static bool quick_consolidate(arena_t *arena);
+static bool resize_block(arena_t *arena, block_t *block, size_t asize);
+static size_t get_asize(size_t size);
+static size_t get_usable_size(void *bp);
+static void fill_zero(void *bp, size_t size);
+static void copy_payload(void *dst, const void *src, size_t size);
+
+static bool arena_init(arena_t *arena);
+static void arena_reset(arena_t *arena);
+static arena_t *get_thread_arena(void);
+static arena_t *payload_to_arena(void *bp);
+static void *arena_sbrk(arena_t *arena, size_t incr);
+static void arena_reserve_region(void);
+static block_t *arena_epilogue(arena_t *arena);
+static size_t arena_heap_size(arena_t *arena);
+static bool arena_uses_sbrk(arena_t *arena);
+static size_t arena_page_size(arena_t *arena);
+static bool arena_trim(arena_t *arena, size_t pad);
+static size_t arena_decommit(arena_t *arena, size_t min_size);
+#ifdef BEST_FIT_TREE
+static size_t decommit_tree(arena_t *arena, block_t *root, size_t min_size);
+#endif
+static size_t decommit_block(arena_t *arena, block_t *block);
+static void prefault(void *start, size_t size);
+static void remote_free(arena_t *arena, void *bp);
+static void drain_remote_frees(arena_t *arena);
+
+static void *alloc_payload(size_t size);
+static void *heap_malloc(arena_t *arena, size_t size);
+static void *mmap_alloc(size_t size, size_t align);
+static void mmap_free(void *bp);
+static void *mmap_realloc(void *bp, size_t size);
+static bool is_mmap_payload(void *bp);
+static size_t get_mmap_offset(void *bp);
+static void *slab_alloc(arena_t *arena, int class_index);
+static int get_slab_class(size_t size);
+static void slab_free(arena_t *arena, void *bp);
+static slab_t *slab_new(arena_t *arena, int class_index);
+static bool is_slab_payload(void *bp);
+static slab_t *payload_to_slab(void *bp);
+static bool slab_pagemap_reserve(arena_t *arena, size_t page);
+static void slab_pagemap_set(arena_t *arena, size_t page, bool is_slab);
+
+static void *tcache_alloc(int class_index);
+static bool tcache_free(void *bp, int class_index);
+static void *tcache_refill(arena_t *arena, int class_index);
+static void tcache_flush(arena_t *arena, int class_index, uint32_t keep);
+static void slot_free(void *bp, int class_index);
+static void tcache_check_generation(void);
+static void tcache_register(void);
+static void tcache_make_key(void);
+static void tcache_thread_exit(void *arg);
+
+static void stats_count_malloc(size_t size, size_t n);
+static void stats_count_free(size_t n);
+static void stats_add(size_t *counter, size_t n);
+static void stats_merge(mm_stats_t *stats, thread_stats_t *thread);
+
+static bool sample_arm(size_t size);
+static size_t sample_next_gap(size_t mean);
+static double sample_log(double x);
+static void *sample_malloc(size_t size);
+static sample_t *sample_take(void);
+static void sample_insert(sample_t *sample);
+static void sample_remove(void *bp);
+static void sample_reset(void);
+static sample_t **sample_bucket(void *bp);
+static bool is_sampled_payload(void *bp);
+
+static bool guard_arm(size_t size);
+static void *guard_malloc(size_t size);
+static void guard_free(void *bp);
+static void *guard_realloc(void *bp, size_t size);
+static void guard_pool_init(void);
+static void guard_reset(void);
+static bool is_guard_payload(void *bp);
+static size_t guard_payload_size(void *bp);
+static char *guard_slot_page(size_t slot);
+static int write_all(int fd, const char *buf, size_t len);
 
 static size_t max(size_t x, size_t y);
+static size_t min(size_t x, size_t y);
 static size_t round_up(size_t size, size_t n);
 /*add prev_alloc parameter to remove footer*/
 static word_t pack(size_t size, bool prev_alloc, bool alloc);
@@ -144,23 +701,188 @@ static block_t *find_next(block_t *block);
 static word_t *find_prev_footer(block_t *block);
 static block_t *find_prev(block_t *block);
 
+static int get_seg_index(size_t size);
+static void set_list_bit(arena_t *arena, int index);
+static void clear_list_bit(arena_t *arena, int index);
+static bool get_list_bit(arena_t *arena, int index);
+
+#ifdef DENSE_INDEX
+/*
+*Implement dense class arrays
+*a removed entry is replaced by the last one, so both are O(1)
+*/
+
+/*helper function to remove a block from the array of its class*/
+static void fl_remove(arena_t *arena, block_t *block){
+    if(block == NULL || get_alloc(block)){
+        return;
+    }
+
+    int index = get_seg_index(get_size(block));
+    dense_index_t *dense = &arena->dense_index[index];
+    uintptr_t pos = (uintptr_t)block->prev;
+
+    arena->stats.free_bytes -= get_size(block);
+    block->prev = NULL;
+    block->next = NULL;
+    if(pos == dense_unindexed)
+        return;
+    //the last entry moves into the hole and its block learns where
+    dense->entries[pos] = dense->entries[--dense->count];
+    dense->entries[pos].block->prev = (block_t *)pos;
+    if(dense->count == 0)
+        clear_list_bit(arena, index);
+}
+
+/*helper function to insert block into the array of its class*/
+static void fl_insert(arena_t *arena, block_t *block){
+    if(block == NULL)
+        return;
+    int index = get_seg_index(get_size(block));
+    dense_index_t *dense = &arena->dense_index[index];
+
+    arena->stats.free_bytes += get_size(block);
+    block->next = NULL;
+    if(dense->count == dense->capacity && !dense_grow(dense)){
+        block->prev = (block_t *)dense_unindexed;
+        return;
+    }
+    dense->entries[dense->count].size = get_size(block);
+    dense->entries[dense->count].block = block;
+    block->prev = (block_t *)(uintptr_t)dense->count;
+    if(dense->count++ == 0)
+        set_list_bit(arena, index);
+}
+
+/*helper function to double the capacity of a class array*/
+static bool dense_grow(dense_index_t *dense){
+    size_t old_size = dense->capacity * sizeof(dense_entry_t);
+    size_t new_size = (old_size != 0) ? 2 * old_size : page_size;
+    void *entries;
+
+    if(new_size / sizeof(dense_entry_t) > UINT32_MAX)
+        return false;
+    if(dense->entries == NULL)
+        entries = mmap(NULL, new_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    else
+        entries = mremap(dense->entries, old_size, new_size, MREMAP_MAYMOVE);
+    if(entries == MAP_FAILED)
+        return false;
+    dense->entries = entries;
+    dense->capacity = new_size / sizeof(dense_entry_t);
+    return true;
+}
+
+#elif defined(BEST_FIT_TREE)
+/*
+*Implement best fit trees
+*each class is a treap: ordered by (size, address), and a parent's
+*priority, a hash of its address, is never lower than its children's
+*/
+
+/*helper function to remove a block from the tree of its class*/
+static void fl_remove(arena_t *arena, block_t *block){
+    if(block == NULL || get_alloc(block)){
+        return;
+    }
+
+    int index = get_seg_index(get_size(block));
+    block_t **link = &arena->freelist_start[index];
+    block_t *left = block->prev;
+    block_t *right = block->next;
+
+    arena->stats.free_bytes -= get_size(block);
+    //walk down to the link that points at the block
+    while(*link != block)
+        link = tree_less(block, *link) ? &(*link)->prev : &(*link)->next;
+
+    //merge the two subtrees in its place, higher priority on top
+    while(left != NULL && right != NULL){
+        if(tree_priority(left) > tree_priority(right)){
+            *link = left;
+            link = &left->next;
+            left = left->next;
+        }else{
+            *link = right;
+            link = &right->prev;
+            right = right->prev;
+        }
+    }
+    *link = (left != NULL) ? left : right;
+
+    block->next = NULL;
+    block->prev = NULL;
+    if(arena->freelist_start[index] == NULL)
+        clear_list_bit(arena, index);
+}
+
+/*helper function to insert block into the tree of its class*/
+static void fl_insert(arena_t *arena, block_t *block){
+    if(block == NULL)
+        return;
+    int index = get_seg_index(get_size(block));
+    block_t **link = &arena->freelist_start[index];
+    block_t **left = &block->prev;
+    block_t **right = &block->next;
+    block_t *t;
+
+    arena->stats.free_bytes += get_size(block);
+    if(*link == NULL)
+        set_list_bit(arena, index);
+    //walk down past every node of higher priority
+    while(*link != NULL && tree_priority(*link) > tree_priority(block))
+        link = tree_less(block, *link) ? &(*link)->prev : &(*link)->next;
+
+    //split the subtree found there into the block's two children
+    t = *link;
+    while(t != NULL){
+        if(tree_less(t, block)){
+            *left = t;
+            left = &t->next;
+            t = t->next;
+        }else{
+            *right = t;
+            right = &t->prev;
+            t = t->prev;
+        }
+    }
+    *left = NULL;
+    *right = NULL;
+    *link = block;
+}
+
+/*helper function to order free blocks by size, then by address*/
+static bool tree_less(block_t *a, block_t *b){
+    size_t size_a = get_size(a);
+    size_t size_b = get_size(b);
+    return size_a < size_b || (size_a == size_b && a < b);
+}
+
+/*helper function to return the treap priority of a free block*/
+static word_t tree_priority(block_t *block){
+    //multiplying by an odd constant gives distinct, well mixed values
+    return (word_t)block * 0x9E3779B97F4A7C15ULL;
+}
+
+#else
 /*
-*Implement explicit free list
+*Implement segregated free lists
 *free list remove and insert functions
 */
 
-/*helper function to remove a block from the freelist*/
-static void fl_remove(block_t *block){
-    //dbg_printf("fl_remove: ");
-    //dbg_printf("freelist_start: %p\n", freelist_start);
-    //mm_printheap();
+/*helper function to remove a block from its segregated freelist*/
+static void fl_remove(arena_t *arena, block_t *block){
     if(block == NULL || get_alloc(block)){
         return;
     }
 
     block_t * nextptr = block->next;
     block_t * prevptr = block->prev;
+    /*the list the block lives in is decided by its size*/
+    int index = get_seg_index(get_size(block));
 
+    arena->stats.free_bytes -= get_size(block);
     //set the next and prev pointer of current block to 0
     //  because it is removed from the free list
     block->next = NULL;
@@ -168,12 +890,14 @@ static void fl_remove(block_t *block){
     
     //if the prev and next pointers are both null, set freelist to null
     if(nextptr==NULL && prevptr==NULL){
-        freelist_start = NULL;
+        arena->freelist_start[index] = NULL;
+        /*the list is empty now, clear its bit*/
+        clear_list_bit(arena, index);
     }
     //if only the prev pointer is null, set the start to next pointer
     else if(prevptr==NULL){
         nextptr->prev = NULL;
-        freelist_start = nextptr;
+        arena->freelist_start[index] = nextptr;
     }
     //if only the next pointer is null, 
     //  set the next pointer of the prev pointer to NULL
@@ -188,258 +912,2475 @@ static void fl_remove(block_t *block){
         prevptr->next = nextptr;
         nextptr->prev = prevptr;
     }
-    //dbg_printf("fl_remove end: %p\n", freelist_start);
-    //mm_printheap();
 }
 
-/*helper function to insert block into freelist*/
-static void fl_insert(block_t *block){
-    //dbg_printf("fl_insert start: ");
-    //dbg_printf("%p\n", freelist_start);
-    //mm_printheap();
+/*helper function to insert block into its segregated freelist*/
+static void fl_insert(arena_t *arena, block_t *block){
     if(block == NULL)
         return;
+    int index = get_seg_index(get_size(block));
+
+    arena->stats.free_bytes += get_size(block);
+    /*the block becomes the new start, so nothing comes before it*/
+    block->prev = NULL;
     //if the freelist is null set the block as the start
-    if(freelist_start == NULL){
-        freelist_start = block;
-        //dbg_printf("fl_insert end: ");
-        //dbg_printf("%p\n", freelist_start);
-        //mm_printheap();
+    if(arena->freelist_start[index] == NULL){
+        block->next = NULL;
+        arena->freelist_start[index] = block;
+        /*the list is not empty anymore, set its bit*/
+        set_list_bit(arena, index);
         return;
     }
     //set block as the start and make freelist point to the block
-    block->next = freelist_start;
-    freelist_start->prev = block;
-    freelist_start = block;
-    //dbg_printf("fl_insert end: ");
-    //dbg_printf("%p\n", freelist_start);
-    //mm_printheap();
+    block->next = arena->freelist_start[index];
+    arena->freelist_start[index]->prev = block;
+    arena->freelist_start[index] = block;
 }
-
+#endif
 
 /*
- * <what does mm_init do?>
- */
-bool mm_init(void) 
-{
-    //dbg_printf("mm_init: \n");
-    // Create the initial empty heap 
-    word_t *start = (word_t *)(mem_sbrk(2*wsize));
+*Implement slab allocator for small requests
+*slab pages are allocated blocks, so the heap itself does not change
+*/
 
-    if (start == (void *)-1) 
-    {
-        return false;
+/*helper function to return a free slot of the given slab class*/
+static void *slab_alloc(arena_t *arena, int class_index){
+    slab_t *slab = arena->slab_partial[class_index];
+    int word = 0;
+    int bit;
+
+    //no slab of this class has a free slot, carve a new page
+    if(slab == NULL){
+        slab = slab_new(arena, class_index);
+        if(slab == NULL)
+            return NULL;
     }
 
-    start[0] = pack(0, true, true); // Prologue footer
-    start[1] = pack(0, true, true); // Epilogue header
-    // Heap starts with first "block header", currently the epilogue footer
-    heap_start = (block_t *) &(start[1]);
-    freelist_start = NULL;
+    //find the lowest free slot
+    while(slab->free_map[word] == 0)
+        word++;
+    bit = __builtin_ctzll(slab->free_map[word]);
+    slab->free_map[word] &= ~((word_t)1 << bit);
+    slab->free_count--;
 
-    // Extend the empty heap with a free block of chunksize bytes
-    if (extend_heap(chunksize) == NULL)
-    {
-        return false;
+    //a full slab is taken off the partial list until a slot is freed
+    if(slab->free_count == 0){
+        arena->slab_partial[class_index] = slab->next;
+        if(slab->next != NULL)
+            slab->next->prev = NULL;
+        slab->next = NULL;
     }
-    return true;
+    return slab->slots + (size_t)(word * 64 + bit) * slab->slot_size;
 }
 
-/*
- * <what does mmalloc do?>
- */
-void *malloc(size_t size) 
-{
-    //dbg_printf("malloc start: \n");
-    //mm_printheap();
-    dbg_requires(mm_checkheap(__LINE__));
-    size_t asize;      // Adjusted block size
-    size_t extendsize; // Amount to extend heap if no fit is found
-    block_t *block;
-    void *bp = NULL;
+/*helper function to give a slot back to its slab page*/
+static void slab_free(arena_t *arena, void *bp){
+    slab_t *slab = payload_to_slab(bp);
+    size_t slot = ((char *)bp - slab->slots) / slab->slot_size;
+    slab_t **head = &arena->slab_partial[slab->class_index];
 
-    if (heap_start == NULL) // Initialize heap if it isn't initialized
-    {
-        mm_init();
+    dbg_assert(!((slab->free_map[slot / 64] >> (slot % 64)) & 1));
+    slab->free_map[slot / 64] |= (word_t)1 << (slot % 64);
+
+    //the slab was full, put it back on the partial list
+    if(slab->free_count++ == 0){
+        slab->prev = NULL;
+        slab->next = *head;
+        if(*head != NULL)
+            (*head)->prev = slab;
+        *head = slab;
     }
 
-    if (size == 0) // Ignore spurious request
-    {
-        dbg_ensures(mm_checkheap(__LINE__));
-        return bp;
+    //give an empty page back to the heap unless it is the last one
+    //  of its class, so alternating malloc and free does not thrash
+    if(slab->free_count == slab->slot_count && (slab->prev || slab->next)){
+        if(slab->prev != NULL)
+            slab->prev->next = slab->next;
+        else
+            *head = slab->next;
+        if(slab->next != NULL)
+            slab->next->prev = slab->prev;
+        slab_pagemap_set(arena, (uintptr_t)slab / slab_page_size - arena->slab_base_page, false);
+        free_block(arena, payload_to_header(slab));
     }
+}
 
-    // Adjust block size to include overhead and to meet alignment requirements
-    /*add only the header size to the given size 
-          because it will be allocated and we removed footer for allocated blocks*/
-    asize = round_up(size + wsize, dsize);
-    /*check to make sure that asize is bigger than the min_block_size*/
-    if(asize<min_block_size)
-        asize = min_block_size;
-  
-    // Search the free list for a fit
-    block = find_fit(asize);
+/*helper function to carve a new slab page for the given class*/
+static slab_t *slab_new(arena_t *arena, int class_index){
+    block_t *block = alloc_aligned_block(arena, slab_page_size, slab_page_size);
+    slab_t *slab;
+    size_t page;
 
-    // If no fit is found, request more memory, and then and place the block
-    if (block == NULL)
-    {  
-        extendsize = max(asize, chunksize);
-        block = extend_heap(extendsize);
-        if (block == NULL) // extend_heap returns an error
-        {
-            return bp;
-        }
+    if(block == NULL)
+        return NULL;
+    slab = (slab_t *)header_to_payload(block);
+    page = (uintptr_t)slab / slab_page_size - arena->slab_base_page;
+    if(!slab_pagemap_reserve(arena, page)){
+        free_block(arena, block);
+        return NULL;
+    }
+    slab_pagemap_set(arena, page, true);
 
+    /*the slots end where the next block header starts*/
+    slab->slot_size = (class_index + 1) * dsize;
+    slab->slot_count = (get_payload_size(block) - sizeof(slab_t)) / slab->slot_size;
+    slab->free_count = slab->slot_count;
+    slab->class_index = class_index;
+    for(int i = 0; i < SLAB_MAP_WORDS; i++){
+        size_t first = i * 64;
+        if(slab->slot_count >= first + 64)
+            slab->free_map[i] = ~(word_t)0;
+        else if(slab->slot_count > first)
+            slab->free_map[i] = ((word_t)1 << (slab->slot_count - first)) - 1;
+        else
+            slab->free_map[i] = 0;
     }
 
-    place(block, asize);
-    bp = header_to_payload(block);
-    //dbg_printf("malloc end printheap: \n");
-    //mm_printheap();
-    dbg_ensures(mm_checkheap(__LINE__));
-    return bp;
-} 
+    slab->prev = NULL;
+    slab->next = arena->slab_partial[class_index];
+    if(slab->next != NULL)
+        slab->next->prev = slab;
+    arena->slab_partial[class_index] = slab;
+    return slab;
+}
 
 /*
- * <what does free do?>
+ * helper function to check if a payload pointer is a slot of a slab.
+ * safe without any lock: the page of a live slot stays marked and
+ * every map that was ever published stays readable.
  */
-void free(void *bp)
-{
-    if (bp == NULL)
-    {
-        return;
-    }
-
-    block_t *block = payload_to_header(bp);
-    size_t size = get_size(block);
-    //dbg_printf("free1: ");
-    //dbg_printf(" %p\n", block);
-    //mm_printheap();
+static bool is_slab_payload(void *bp){
+    arena_t *arena = payload_to_arena(bp);
+    size_t page = (uintptr_t)bp / slab_page_size - arena->slab_base_page;
+    word_t *map = __atomic_load_n(&arena->slab_pagemap, __ATOMIC_ACQUIRE);
+    if(map == NULL || page >= map[0])
+        return false;
+    return (__atomic_load_n(&map[1 + page / 64], __ATOMIC_RELAXED) >> (page % 64)) & 1;
+}
 
-    /*write new header and footer to the block to free it*/
-    write_header(block, size, get_prev_alloc(block), false);
-    write_footer(block, size, get_prev_alloc(block), false);
-    //set_next_prev_alloc(block, false);
-    //set_next_prev_alloc_footer(block, false);
+/*helper function to return the slab class that holds size bytes*/
+static int get_slab_class(size_t size){
+    return (round_up(size, dsize) / dsize) - 1;
+}
 
-    /*set the block's prev and next to null because it is a new free block*/
-    block->prev = NULL;
-    block->next = NULL;
-    //dbg_printf("free2: \n");
-    //mm_printheap();
-    /*coalesce the new free block*/
-    coalesce(block);
-    
+/*helper function to find the slab page a slot belongs to*/
+static slab_t *payload_to_slab(void *bp){
+    return (slab_t *)((uintptr_t)bp & ~(uintptr_t)(slab_page_size - 1));
 }
 
 /*
- * realloc: reallocate a given pointer with a given size
+ * helper function to make sure the pagemap covers the given page.
+ * the map grows geometrically and is copied into a bigger block,
+ * the old one stays allocated because other threads may still read it.
+ * returns false if the heap cannot hold the bigger map.
  */
-void *realloc(void *ptr, size_t size)
+static bool slab_pagemap_reserve(arena_t *arena, size_t page){
+    size_t old_bits = (arena->slab_pagemap != NULL) ? arena->slab_pagemap[0] : 0;
+    size_t bits = max(2 * old_bits, round_up(page + 1, 64));
+    size_t bytes = wsize + bits / 8;
+    block_t *block;
+    word_t *map;
+
+    if(page < old_bits)
+        return true;
+    block = alloc_block(arena, max(round_up(bytes + wsize, dsize), min_block_size));
+    if(block == NULL)
+        return false;
+    map = (word_t *)header_to_payload(block);
+    memset(map, 0, bytes);
+    if(arena->slab_pagemap != NULL)
+        memcpy(map + 1, arena->slab_pagemap + 1, old_bits / 8);
+    map[0] = bits;
+    __atomic_store_n(&arena->slab_pagemap, map, __ATOMIC_RELEASE);
+    return true;
+}
+
+/*helper function to mark a page in the pagemap as slab or not*/
+static void slab_pagemap_set(arena_t *arena, size_t page, bool is_slab){
+    word_t *word = &arena->slab_pagemap[1 + page / 64];
+    if(is_slab)
+        __atomic_or_fetch(word, (word_t)1 << (page % 64), __ATOMIC_RELAXED);
+    else
+        __atomic_and_fetch(word, ~((word_t)1 << (page % 64)), __ATOMIC_RELAXED);
+}
+
+/*
+*Implement thread caches in front of the slab allocator
+*everything here only touches the calling thread's tcache,
+*except for refill and flush which need the arena lock
+*/
+
+/*helper function to pop a cached slot, returns NULL on a miss*/
+static void *tcache_alloc(int class_index){
+    void *bp;
+    tcache_check_generation();
+    bp = mm_tcache.bins[class_index];
+    if(bp != NULL){
+        mm_tcache.bins[class_index] = *(void **)bp;
+        mm_tcache.counts[class_index]--;
+    }
+    return bp;
+}
+
+/*helper function to cache a freed slot, returns false if the bin is full*/
+static bool tcache_free(void *bp, int class_index){
+    tcache_check_generation();
+    if(mm_tcache.counts[class_index] >= tcache_bin_max)
+        return false;
+    *(void **)bp = mm_tcache.bins[class_index];
+    mm_tcache.bins[class_index] = bp;
+    mm_tcache.counts[class_index]++;
+    return true;
+}
+
+/*
+ * helper function to take a batch of slots from the slab pages,
+ * keeps all but one in the cache and returns that one.
+ * requires the arena lock.
+ */
+static void *tcache_refill(arena_t *arena, int class_index){
+    void *bp = slab_alloc(arena, class_index);
+    tcache_register();
+    tcache_check_generation();
+    for(uint32_t i = 1; bp != NULL && i < tcache_batch; i++){
+        void *extra = slab_alloc(arena, class_index);
+        if(extra == NULL)
+            break;
+        *(void **)extra = mm_tcache.bins[class_index];
+        mm_tcache.bins[class_index] = extra;
+        mm_tcache.counts[class_index]++;
+    }
+    return bp;
+}
+
+/*
+ * helper function to give cached slots back to their slab pages
+ * until only keep of them are left in the bin. slots of other arenas
+ * are queued for their owner.
+ * requires the arena lock.
+ */
+static void tcache_flush(arena_t *arena, int class_index, uint32_t keep){
+    while(mm_tcache.counts[class_index] > keep){
+        void *bp = mm_tcache.bins[class_index];
+        arena_t *owner = payload_to_arena(bp);
+        mm_tcache.bins[class_index] = *(void **)bp;
+        mm_tcache.counts[class_index]--;
+        if(owner == arena)
+            slab_free(arena, bp);
+        else
+            remote_free(owner, bp);
+    }
+}
+
+/*
+ * helper function to free a slot into the thread cache, only a full bin
+ * gives half of its slots back to the slab pages
+ */
+static void slot_free(void *bp, int class_index){
+    arena_t *arena;
+    if(tcache_free(bp, class_index))
+        return;
+    arena = get_thread_arena();
+    pthread_mutex_lock(&arena->lock);
+    tcache_register();
+    tcache_flush(arena, class_index, tcache_bin_max / 2);
+    tcache_free(bp, class_index);
+    drain_remote_frees(arena);
+    pthread_mutex_unlock(&arena->lock);
+}
+
+/*helper function to forget cached slots that belong to an older heap*/
+static void tcache_check_generation(void){
+    if(mm_tcache.generation == mm_heap_generation)
+        return;
+    for(int i = 0; i < SLAB_CLASS_COUNT; i++){
+        mm_tcache.bins[i] = NULL;
+        mm_tcache.counts[i] = 0;
+    }
+    mm_tcache.generation = mm_heap_generation;
+}
+
+/*helper function to flush the cache when the calling thread exits*/
+static void tcache_register(void){
+    if(mm_tcache.registered)
+        return;
+    //set first, pthread_setspecific may call malloc
+    mm_tcache.registered = true;
+    pthread_mutex_lock(&stats_lock);
+    mm_tcache.stats_prev = NULL;
+    mm_tcache.stats_next = stats_threads;
+    if(stats_threads != NULL)
+        stats_threads->stats_prev = &mm_tcache;
+    stats_threads = &mm_tcache;
+    pthread_mutex_unlock(&stats_lock);
+    pthread_once(&tcache_key_once, tcache_make_key);
+    pthread_setspecific(tcache_key, &mm_tcache);
+}
+
+/*helper function to create the key whose destructor flushes caches*/
+static void tcache_make_key(void){
+    pthread_key_create(&tcache_key, tcache_thread_exit);
+}
+
+/*
+ * destructor of tcache_key, gives every cached slot back and adds the
+ * counters of the thread to stats_exited. later mallocs of the exiting
+ * thread are not counted.
+ */
+static void tcache_thread_exit(void *arg){
+    arena_t *arena = get_thread_arena();
+    (void)arg;
+    pthread_mutex_lock(&arena->lock);
+    tcache_check_generation();
+    for(int i = 0; i < SLAB_CLASS_COUNT; i++)
+        tcache_flush(arena, i, 0);
+    //the arena may see no other malloc for a long time
+    drain_remote_frees(arena);
+    pthread_mutex_unlock(&arena->lock);
+
+    pthread_mutex_lock(&stats_lock);
+    stats_exited.mallocs += mm_tcache.stats.mallocs;
+    stats_exited.frees += mm_tcache.stats.frees;
+    for(int i = 0; i < MM_STATS_CLASS_COUNT; i++)
+        stats_exited.size_classes[i] += mm_tcache.stats.size_classes[i];
+    if(mm_tcache.stats_prev != NULL)
+        mm_tcache.stats_prev->stats_next = mm_tcache.stats_next;
+    else
+        stats_threads = mm_tcache.stats_next;
+    if(mm_tcache.stats_next != NULL)
+        mm_tcache.stats_next->stats_prev = mm_tcache.stats_prev;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+/*
+*Implement statistics
+*the hot paths only bump counters that nothing else writes
+*/
+
+/*helper function to count n mallocs of size bytes for this thread*/
+static void stats_count_malloc(size_t size, size_t n){
+    int class_index = (size > 1) ? 63 - __builtin_clzll(size) : 0;
+    if(class_index >= MM_STATS_CLASS_COUNT)
+        class_index = MM_STATS_CLASS_COUNT - 1;
+    tcache_register();
+    stats_add(&mm_tcache.stats.mallocs, n);
+    stats_add(&mm_tcache.stats.size_classes[class_index], n);
+}
+
+/*helper function to count n frees for this thread*/
+static void stats_count_free(size_t n){
+    tcache_register();
+    stats_add(&mm_tcache.stats.frees, n);
+}
+
+/*
+ * helper function to add to a counter of the calling thread, a load and
+ * a store rather than a locked add since no other thread writes it
+ */
+static void stats_add(size_t *counter, size_t n){
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n,
+                     __ATOMIC_RELAXED);
+}
+
+/*helper function to add the counters of a thread to a snapshot*/
+static void stats_merge(mm_stats_t *stats, thread_stats_t *thread){
+    stats->mallocs += __atomic_load_n(&thread->mallocs, __ATOMIC_RELAXED);
+    stats->frees += __atomic_load_n(&thread->frees, __ATOMIC_RELAXED);
+    for(int i = 0; i < MM_STATS_CLASS_COUNT; i++)
+        stats->size_classes[i] += __atomic_load_n(&thread->size_classes[i],
+                                                  __ATOMIC_RELAXED);
+}
+
+/*
+*Implement the sampling heap profiler
+*only sample_malloc and the frees of sampled blocks take sample_lock
+*/
+
+/*
+ * helper function called when a request of size bytes used up the
+ * countdown of the thread, draws the next gap and returns true if the
+ * request is to be sampled
+ */
+static bool sample_arm(size_t size){
+    size_t interval = __atomic_load_n(&sample_interval, __ATOMIC_RELAXED);
+    if(interval == 0){
+        mm_tcache.sample_left = sample_recheck;
+        return false;
+    }
+    mm_tcache.sample_left = sample_next_gap(interval);
+    return size != 0 && !mm_tcache.sampling;
+}
+
+/*helper function to draw a gap with an exponential distribution of the given mean*/
+static size_t sample_next_gap(size_t mean){
+    word_t x = mm_tcache.sample_seed;
+    double u;
+    //xorshift64, seeded from the address of the thread's cache
+    if(x == 0)
+        x = (word_t)&mm_tcache * 0x9E3779B97F4A7C15ULL | 1;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    mm_tcache.sample_seed = x;
+    //u is uniform in (0, 1], and -ln(u) * mean is exponential
+    u = (double)((x >> 11) + 1) / (double)((word_t)1 << 53);
+    return (size_t)(-sample_log(u) * (double)mean) + 1;
+}
+
+/*
+ * helper function to return the natural logarithm of x > 0 without libm:
+ * x = m * 2^e with m in [1, 2), and ln(m) = 2 atanh((m - 1) / (m + 1))
+ * from a series that is within 1e-5 for such m
+ */
+static double sample_log(double x){
+    word_t bits;
+    double m, t, t2;
+    int e;
+
+    memcpy(&bits, &x, sizeof(bits));
+    e = (int)((bits >> 52) & 0x7FF) - 1023;
+    bits = (bits & (((word_t)1 << 52) - 1)) | ((word_t)1023 << 52);
+    memcpy(&m, &bits, sizeof(m));
+    t = (m - 1) / (m + 1);
+    t2 = t * t;
+    return e * 0.6931471805599453 + 2 * t * (1 + t2 * (1.0 / 3 + t2 * (1.0 / 5 + t2 / 7)));
+}
+
+/*
+ * helper function to allocate a sampled payload and record the stack
+ * of its caller. small sizes take a heap block rather than a slot,
+ * since only a block has a header for the sampled bit. a payload whose
+ * record cannot be allocated is handed out unsampled.
+ */
+static void *sample_malloc(size_t size){
+    void *stack[SAMPLE_MAX_DEPTH + 2];
+    sample_t *sample;
+    arena_t *arena;
+    void *bp;
+    int depth;
+
+    //backtrace may allocate when it is first called
+    mm_tcache.sampling = true;
+    depth = backtrace(stack, SAMPLE_MAX_DEPTH + 2);
+    sample = sample_take();
+
+    if(size >= __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED)){
+        bp = mmap_alloc(size, dsize);
+        if(bp != NULL && sample != NULL)
+            payload_to_header(bp)->header |= sampled_mask;
+    }else{
+        arena = get_thread_arena();
+        pthread_mutex_lock(&arena->lock);
+        bp = heap_malloc(arena, max(size, slab_max_size + 1));
+        if(bp != NULL && sample != NULL){
+            block_t *block = payload_to_header(bp);
+            __atomic_store_n(&block->header, block->header | sampled_mask, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock(&arena->lock);
+    }
+
+    if(sample != NULL){
+        //the first two frames are sample_malloc and malloc
+        sample->bp = bp;
+        sample->size = size;
+        sample->depth = (depth > 2) ? depth - 2 : 0;
+        memcpy(sample->stack, stack + 2, sample->depth * sizeof(void *));
+        sample_insert(sample);
+    }
+    mm_tcache.sampling = false;
+    return bp;
+}
+
+/*
+ * helper function to take an unused record, a new chunk of them is
+ * mapped when there is none. returns NULL if out of memory.
+ */
+static sample_t *sample_take(void){
+    sample_t *sample = NULL;
+
+    pthread_mutex_lock(&sample_lock);
+    if(sample_table == NULL){
+        void *table = mmap(NULL, SAMPLE_TABLE_SIZE * sizeof(sample_t *), PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(table != MAP_FAILED)
+            sample_table = table;
+    }
+    if(sample_unused == NULL && sample_table != NULL){
+        sample_t *chunk = mmap(NULL, sample_chunk_size, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(chunk != MAP_FAILED){
+            for(size_t i = 0; i < sample_chunk_size / sizeof(sample_t); i++){
+                chunk[i].next = sample_unused;
+                sample_unused = &chunk[i];
+            }
+        }
+    }
+    if(sample_unused != NULL){
+        sample = sample_unused;
+        sample_unused = sample->next;
+    }
+    pthread_mutex_unlock(&sample_lock);
+    return sample;
+}
+
+/*helper function to add a record to the table, or give it back if its payload is NULL*/
+static void sample_insert(sample_t *sample){
+    pthread_mutex_lock(&sample_lock);
+    if(sample->bp == NULL){
+        sample->next = sample_unused;
+        sample_unused = sample;
+    }else{
+        sample_t **bucket = sample_bucket(sample->bp);
+        sample->next = *bucket;
+        *bucket = sample;
+    }
+    pthread_mutex_unlock(&sample_lock);
+}
+
+/*helper function to drop the record of a sampled payload that is freed*/
+static void sample_remove(void *bp){
+    sample_t **link;
+
+    pthread_mutex_lock(&sample_lock);
+    for(link = sample_bucket(bp); *link != NULL; link = &(*link)->next){
+        if((*link)->bp == bp){
+            sample_t *sample = *link;
+            *link = sample->next;
+            sample->next = sample_unused;
+            sample_unused = sample;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sample_lock);
+}
+
+/*helper function to drop every record, the payloads belong to an old heap*/
+static void sample_reset(void){
+    pthread_mutex_lock(&sample_lock);
+    for(int i = 0; sample_table != NULL && i < SAMPLE_TABLE_SIZE; i++){
+        while(sample_table[i] != NULL){
+            sample_t *sample = sample_table[i];
+            sample_table[i] = sample->next;
+            sample->next = sample_unused;
+            sample_unused = sample;
+        }
+    }
+    pthread_mutex_unlock(&sample_lock);
+}
+
+/*helper function to return the hash bucket of a payload. requires sample_lock.*/
+static sample_t **sample_bucket(void *bp){
+    word_t hash = ((word_t)bp >> 4) * 0x9E3779B97F4A7C15ULL;
+    return &sample_table[hash >> (64 - __builtin_ctz(SAMPLE_TABLE_SIZE))];
+}
+
+/*
+ * helper function to tell whether a payload that is not a slab slot is
+ * sampled. safe without any lock, the bit does not change while the
+ * payload is allocated.
+ */
+static bool is_sampled_payload(void *bp){
+    return __atomic_load_n(&payload_to_header(bp)->header, __ATOMIC_RELAXED)
+           & sampled_mask;
+}
+
+/*helper function to write all of buf to fd, returns -1 on an error*/
+static int write_all(int fd, const char *buf, size_t len){
+    while(len > 0){
+        ssize_t n = write(fd, buf, len);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+*Implement the guard pool
+*only guarded payloads take guard_lock, and only to change hands
+*/
+
+/*
+ * helper function called when a malloc of size bytes used up the guard
+ * countdown of the thread, draws the next gap and returns true if the
+ * request is to be guarded
+ */
+static bool guard_arm(size_t size){
+    size_t interval = __atomic_load_n(&guard_interval, __ATOMIC_RELAXED);
+    if(interval == 0){
+        mm_tcache.guard_left = guard_recheck;
+        return false;
+    }
+    //an interval of 1 guards every request that fits on a page
+    mm_tcache.guard_left = (interval > 1) ? sample_next_gap(interval) : 1;
+    return size != 0 && size <= page_size && !mm_tcache.sampling;
+}
+
+/*
+ * helper function to put a payload of size bytes on a free page of the
+ * guard pool, returns NULL if there is none so that the request is
+ * served as usual
+ */
+static void *guard_malloc(size_t size){
+    size_t slot;
+    char *page;
+
+    pthread_once(&guard_pool_once, guard_pool_init);
+    if(__atomic_load_n(&guard_pool, __ATOMIC_ACQUIRE) == NULL)
+        return NULL;
+    pthread_mutex_lock(&guard_lock);
+    if(guard_free_count == 0){
+        pthread_mutex_unlock(&guard_lock);
+        return NULL;
+    }
+    slot = guard_free_slots[guard_free_head];
+    page = guard_slot_page(slot);
+    if(mprotect(page, page_size, PROT_READ | PROT_WRITE) != 0){
+        pthread_mutex_unlock(&guard_lock);
+        return NULL;
+    }
+    guard_free_head = (guard_free_head + 1) % GUARD_SLOT_COUNT;
+    guard_free_count--;
+    guard_sizes[slot] = size;
+    pthread_mutex_unlock(&guard_lock);
+    //an overflow past the alignment slack runs into the guard page
+    return page + page_size - round_up(size, dsize);
+}
+
+/*
+ * helper function to free a guarded payload: its page is emptied, made
+ * PROT_NONE and put behind the other free pages. a pointer that is not
+ * a payload guard_malloc handed out, or one freed already, aborts.
+ */
+static void guard_free(void *bp){
+    size_t page_index = ((char *)bp - guard_pool) / page_size;
+    size_t slot = page_index / 2;
+    char *page = guard_slot_page(slot);
+
+    pthread_mutex_lock(&guard_lock);
+    if(page_index % 2 == 0 || guard_sizes[slot] == 0
+            || (char *)bp != page + page_size - round_up(guard_sizes[slot], dsize)){
+        fprintf(stderr, "mm: %s of guarded payload %p\n",
+                (page_index % 2 == 1 && guard_sizes[slot] == 0) ? "double free" : "invalid free", bp);
+        abort();
+    }
+    //the page comes back zeroed and holds no memory while it waits
+    madvise(page, page_size, MADV_DONTNEED);
+    mprotect(page, page_size, PROT_NONE);
+    guard_sizes[slot] = 0;
+    guard_free_slots[(guard_free_head + guard_free_count) % GUARD_SLOT_COUNT] = slot;
+    guard_free_count++;
+    pthread_mutex_unlock(&guard_lock);
+}
+
+/*helper function to move a guarded payload to a new one of size bytes*/
+static void *guard_realloc(void *bp, size_t size){
+    void *newptr = malloc(size);
+    if(newptr != NULL){
+        copy_payload(newptr, bp, min(size, guard_payload_size(bp)));
+        free(bp);
+    }
+    return newptr;
+}
+
+/*helper function to reserve the guard pool with every page PROT_NONE*/
+static void guard_pool_init(void){
+    char *pool = mmap(NULL, guard_pool_size, PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(pool == MAP_FAILED)
+        return;
+    pthread_mutex_lock(&guard_lock);
+    for(uint32_t i = 0; i < GUARD_SLOT_COUNT; i++)
+        guard_free_slots[i] = i;
+    guard_free_head = 0;
+    guard_free_count = GUARD_SLOT_COUNT;
+    pthread_mutex_unlock(&guard_lock);
+    __atomic_store_n(&guard_pool, pool, __ATOMIC_RELEASE);
+}
+
+/*helper function to free every guarded payload, they belong to an old heap*/
+static void guard_reset(void){
+    char *pool = __atomic_load_n(&guard_pool, __ATOMIC_ACQUIRE);
+    if(pool == NULL)
+        return;
+    pthread_mutex_lock(&guard_lock);
+    madvise(pool, guard_pool_size, MADV_DONTNEED);
+    mprotect(pool, guard_pool_size, PROT_NONE);
+    for(uint32_t i = 0; i < GUARD_SLOT_COUNT; i++){
+        guard_sizes[i] = 0;
+        guard_free_slots[i] = i;
+    }
+    guard_free_head = 0;
+    guard_free_count = GUARD_SLOT_COUNT;
+    pthread_mutex_unlock(&guard_lock);
+}
+
+/*
+ * helper function to tell whether a payload lies in the guard pool,
+ * safe without any lock. it has to come before any look at a header,
+ * the word in front of a page sized payload is a guard page.
+ */
+static bool is_guard_payload(void *bp){
+    char *pool = __atomic_load_n(&guard_pool, __ATOMIC_ACQUIRE);
+    return pool != NULL && (char *)bp >= pool
+           && (size_t)((char *)bp - pool) < guard_pool_size;
+}
+
+/*helper function to return the size a guarded payload was allocated for*/
+static size_t guard_payload_size(void *bp){
+    return guard_sizes[((char *)bp - guard_pool) / page_size / 2];
+}
+
+/*helper function to return the page of a slot of the guard pool*/
+static char *guard_slot_page(size_t slot){
+    return guard_pool + (2 * slot + 1) * page_size;
+}
+
+/*
+*Implement arenas
+*each thread sticks to the arena it is handed on its first malloc
+*/
+
+/*
+ * helper function to set up the heap of an arena on its first use.
+ * requires the arena lock.
+ */
+static bool arena_init(arena_t *arena){
+    word_t *start;
+
+    arena->huge = __atomic_load_n(&hugepage_mode, __ATOMIC_RELAXED);
+    if(arena->huge){
+        pthread_once(&arena_region_once, arena_reserve_region);
+        if(arena_region == NULL)
+            arena->huge = false;
+        //pages committed before the mode was turned on
+        else if(arena->region_committed > arena->region_start)
+            madvise(arena->region_start, arena->region_committed - arena->region_start,
+                    MADV_HUGEPAGE);
+    }
+
+    // Create the initial empty heap 
+    start = (word_t *)(arena_sbrk(arena, 2*wsize));
+
+    if (start == (void *)-1) 
+    {
+        return false;
+    }
+
+    start[0] = pack(0, true, true); // Prologue footer
+    start[1] = pack(0, true, true); // Epilogue header
+    // Heap starts with first "block header", currently the epilogue footer
+    arena->heap_start = (block_t *) &(start[1]);
+    /*every segregated freelist starts out empty*/
+    for (int i = 0; i < FREELIST_COUNT; i++)
+        arena->freelist_start[i] = NULL;
+#ifdef DENSE_INDEX
+    //the arrays of an older heap are kept for their memory
+    for (int i = 0; i < SEG_LIST_COUNT; i++)
+        arena->dense_index[i].count = 0;
+#endif
+#ifdef TLSF
+    arena->tlsf_fl_bitmap = 0;
+    for (int i = 0; i < TLSF_FL_COUNT; i++)
+        arena->tlsf_sl_bitmap[i] = 0;
+#else
+    arena->seg_list_bitmap = 0;
+#endif
+    for (int i = 0; i < QUICK_BIN_COUNT; i++)
+        arena->quick_bins[i] = NULL;
+    arena->quick_count = 0;
+    arena->stats.free_bytes = 0;
+    arena->stats.quick_bytes = 0;
+    /*no slab pages exist yet, the pagemap is created with the first one*/
+    for (int i = 0; i < SLAB_CLASS_COUNT; i++)
+        arena->slab_partial[i] = NULL;
+    arena->slab_pagemap = NULL;
+    arena->slab_base_page = (uintptr_t)arena->heap_start / slab_page_size;
+    arena->zero_from = NULL;
+
+    // Extend the empty heap with a free block of chunksize bytes
+    if (extend_heap(arena, policy.chunksize) == NULL)
+    {
+        return false;
+    }
+    return true;
+}
+
+/*
+ * helper function to throw away the heap of an arena, its next malloc
+ * sets it up again. memory of an mmap slice goes back to the OS.
+ * requires the arena lock.
+ */
+static void arena_reset(arena_t *arena){
+    arena->heap_start = NULL;
+    arena->top_released = NULL;
+    arena->zero_from = NULL;
+    arena->check_cursor = NULL;
+    __atomic_store_n(&arena->remote_frees, NULL, __ATOMIC_RELAXED);
+    __atomic_store_n(&arena->remote_count, 0, __ATOMIC_RELAXED);
+    if(arena->region_start != NULL){
+        madvise(arena->region_start, arena->region_committed - arena->region_start,
+                MADV_DONTNEED);
+        arena->region_brk = arena->region_start;
+    }
+}
+
+/*helper function to return the arena of the calling thread*/
+static arena_t *get_thread_arena(void){
+    unsigned int index;
+    if(thread_arena != NULL)
+        return thread_arena;
+
+    index = __atomic_fetch_add(&arena_next, 1, __ATOMIC_RELAXED) % ARENA_COUNT;
+    if(index != 0){
+        //arenas other than 0 need the mmap range, share arena 0 without it
+        pthread_once(&arena_region_once, arena_reserve_region);
+        if(arena_region == NULL)
+            index = 0;
+    }
+    thread_arena = &arenas[index];
+    return thread_arena;
+}
+
+/*helper function to find the arena whose heap holds a payload*/
+static arena_t *payload_to_arena(void *bp){
+    char *region = __atomic_load_n(&arena_region, __ATOMIC_RELAXED);
+    size_t offset = (char *)bp - region;
+    if(region != NULL && (char *)bp >= region
+            && offset < ARENA_COUNT * arena_reserve_size)
+        return &arenas[offset / arena_reserve_size];
+    return &arenas[0];
+}
+
+/*
+ * helper function to grow the heap of an arena by incr bytes,
+ * returns the old end of the heap or (void *)-1 like mem_sbrk.
+ * requires the arena lock.
+ */
+static void *arena_sbrk(arena_t *arena, size_t incr){
+    char *old_brk;
+    if(arena_uses_sbrk(arena))
+        return mem_sbrk(incr);
+
+    if(arena->region_start == NULL){
+        arena->region_start = arena_region + (arena - arenas) * arena_reserve_size;
+        arena->region_brk = arena->region_start;
+        arena->region_committed = arena->region_start;
+    }
+    if(incr > (size_t)(arena->region_start + arena_reserve_size - arena->region_brk))
+        return (void *)-1;
+
+    old_brk = arena->region_brk;
+    /*make the pages the heap grows into readable and writable*/
+    if(old_brk + incr > arena->region_committed){
+        char *end = (char *)round_up((uintptr_t)(old_brk + incr), arena_page_size(arena));
+        if(mprotect(arena->region_committed, end - arena->region_committed,
+                    PROT_READ | PROT_WRITE) != 0)
+            return (void *)-1;
+        if(arena->huge)
+            madvise(arena->region_committed, end - arena->region_committed,
+                    MADV_HUGEPAGE);
+        arena->region_committed = end;
+    }
+    arena->region_brk = old_brk + incr;
+    return old_brk;
+}
+
+/*
+ * helper function to reserve the address range of the arena slices,
+ * one huge page more than needed so the slices can be aligned
+ */
+static void arena_reserve_region(void){
+    void *region = mmap(NULL, ARENA_COUNT * arena_reserve_size + huge_page_size, PROT_NONE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(region != MAP_FAILED)
+        __atomic_store_n(&arena_region,
+                         (char *)round_up((uintptr_t)region, huge_page_size),
+                         __ATOMIC_RELEASE);
+}
+
+/*helper function to tell if an arena's heap is the mem_sbrk heap*/
+static bool arena_uses_sbrk(arena_t *arena){
+    return arena == &arenas[0] && !arena->huge;
+}
+
+/*helper function to return the granularity an arena commits and trims in*/
+static size_t arena_page_size(arena_t *arena){
+    return arena->huge ? huge_page_size : page_size;
+}
+
+/*helper function to return the epilogue header that ends an arena's heap*/
+static block_t *arena_epilogue(arena_t *arena){
+    if(arena_uses_sbrk(arena))
+        return (block_t *)((char *)mem_heap_hi() + 1 - wsize);
+    return (block_t *)(arena->region_brk - wsize);
+}
+
+/*helper function to return how many bytes the heap of an arena spans*/
+static size_t arena_heap_size(arena_t *arena){
+    if(arena_uses_sbrk(arena))
+        return mem_heapsize();
+    return arena->region_brk - arena->region_start;
+}
+
+/*
+ * helper function to give the free block at the end of an arena's heap
+ * back to the OS, except for pad bytes of it.
+ * returns true if any memory was released. requires the arena lock.
+ */
+static bool arena_trim(arena_t *arena, size_t pad){
+    block_t *epilogue = arena_epilogue(arena);
+    block_t *block;
+    size_t size, new_size;
+    char *start, *end;
+
+    if(get_prev_alloc(epilogue))
+        return false;
+    block = find_prev(epilogue);
+    size = get_size(block);
+    pad = max(round_up(pad, dsize), min_block_size);
+    if(pad >= size)
+        return false;
+
+    if(!arena_uses_sbrk(arena)){
+        /*shrink the block so that the new break is on a page boundary*/
+        end = (char *)round_up((uintptr_t)block + pad + wsize, arena_page_size(arena));
+        new_size = end - wsize - (char *)block;
+        if(new_size >= size)
+            return false;
+
+        fl_remove(arena, block);
+        write_header(block, new_size, get_prev_alloc(block), false);
+        write_footer(block, new_size, get_prev_alloc(block), false);
+        fl_insert(arena, block);
+        write_header(find_next(block), 0, false, true);
+        if(arena->zero_from != NULL && arena->zero_from > end - wsize)
+            arena->zero_from = NULL;
+
+        start = (char *)round_up((uintptr_t)arena->region_brk, arena_page_size(arena));
+        arena->region_brk = end;
+        madvise(end, start - end, MADV_DONTNEED);
+        return true;
+    }
+
+    /*keep the header, the list links and the footer of the block*/
+    start = (char *)round_up((uintptr_t)header_to_payload(block) + max(pad, dsize),
+                             page_size);
+    end = (char *)((uintptr_t)find_prev_footer(epilogue) & ~(uintptr_t)(page_size - 1));
+    if(arena->top_released != NULL && arena->top_released < end)
+        end = arena->top_released;
+    if(end <= start)
+        return false;
+    madvise(start, end - start, MADV_DONTNEED);
+    arena->top_released = start;
+    return true;
+}
+
+/*
+ * helper function to give the pages inside the free blocks of an arena
+ * of at least min_size bytes back to the OS, returns the bytes released.
+ * the classes below the one of min_size only hold smaller blocks.
+ */
+static size_t arena_decommit(arena_t *arena, size_t min_size){
+    size_t released = 0;
+    int first = get_seg_index(max(min_size, min_block_size));
+#if defined(DENSE_INDEX)
+    for(int i = first; i < SEG_LIST_COUNT; i++)
+    for(uint32_t k = 0; k < arena->dense_index[i].count; k++)
+        if(arena->dense_index[i].entries[k].size >= min_size)
+            released += decommit_block(arena, arena->dense_index[i].entries[k].block);
+#elif defined(BEST_FIT_TREE)
+    for(int i = first; i < FREELIST_COUNT; i++)
+        released += decommit_tree(arena, arena->freelist_start[i], min_size);
+#else
+    for(int i = first; i < FREELIST_COUNT; i++)
+    for(block_t *block = arena->freelist_start[i]; block != NULL; block = block->next)
+        if(get_size(block) >= min_size)
+            released += decommit_block(arena, block);
+#endif
+    return released;
+}
+
+#ifdef BEST_FIT_TREE
+/*helper function to decommit the blocks of a tree of at least min_size
+    bytes, the left child of a smaller node is smaller too*/
+static size_t decommit_tree(arena_t *arena, block_t *root, size_t min_size){
+    size_t released = 0;
+    while(root != NULL){
+        if(get_size(root) >= min_size){
+            released += decommit_block(arena, root);
+            released += decommit_tree(arena, root->prev, min_size);
+        }
+        root = root->next;
+    }
+    return released;
+}
+#endif
+
+/*
+ * helper function to give the pages of a free block back to the OS,
+ * keeping its header, its links and its footer, and to mark it with
+ * decommit_mask until its header is written again. returns the bytes
+ * released. MADV_FREE would be cheaper but leaves the RSS as it is
+ * until the system runs short of memory.
+ */
+static size_t decommit_block(arena_t *arena, block_t *block){
+    size_t page = arena_page_size(arena);
+    word_t *footer = find_prev_footer(find_next(block));
+    char *start, *end;
+
+    //nothing in a free block but the header, links and footer is written
+    if(block->header & decommit_mask)
+        return 0;
+    start = (char *)round_up((uintptr_t)header_to_payload(block) + dsize, page);
+    end = (char *)((uintptr_t)footer & ~(uintptr_t)(page - 1));
+    if(end <= start || madvise(start, end - start, MADV_DONTNEED) != 0)
+        return 0;
+    __atomic_store_n(&block->header, block->header | decommit_mask, __ATOMIC_RELAXED);
+    *footer = block->header;
+    return end - start;
+}
+
+/*
+ * helper function to hand a payload to the arena that owns it
+ * without any lock, one compare and swap unless other frees race it.
+ * a long queue is drained right here if the owner's lock is free.
+ */
+static void remote_free(arena_t *arena, void *bp){
+    //counted before the push, so that a drain never takes the count below 0
+    size_t count = __atomic_add_fetch(&arena->remote_count, 1, __ATOMIC_RELAXED);
+    void *head = __atomic_load_n(&arena->remote_frees, __ATOMIC_RELAXED);
+    do{
+        *(void **)bp = head;
+    }while(!__atomic_compare_exchange_n(&arena->remote_frees, &head, bp, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    //a trylock never waits, so holding the lock of another arena is fine
+    if(count > remote_drain_min && pthread_mutex_trylock(&arena->lock) == 0){
+        drain_remote_frees(arena);
+        pthread_mutex_unlock(&arena->lock);
+    }
+}
+
+/*
+ * helper function to free every payload other arenas queued.
+ * the whole stack is taken in one exchange, so pushes never see
+ * a node come back and ABA cannot happen.
+ * requires the arena lock.
+ */
+static void drain_remote_frees(arena_t *arena){
+    void *bp;
+    if(__atomic_load_n(&arena->remote_frees, __ATOMIC_RELAXED) == NULL)
+        return;
+
+    bp = __atomic_exchange_n(&arena->remote_frees, NULL, __ATOMIC_ACQUIRE);
+
+    while(bp != NULL){
+        void *next = *(void **)bp;
+        if(is_slab_payload(bp))
+            slab_free(arena, bp);
+        else
+            free_block(arena, payload_to_header(bp));
+        __atomic_sub_fetch(&arena->remote_count, 1, __ATOMIC_RELAXED);
+        bp = next;
+    }
+}
+
+
+/*
+ * mm_init: throws away every arena and creates the initial empty heap
+ *     of arena 0, the other arenas are set up by their next malloc
+ */
+bool mm_init(void) 
+{
+    bool ok;
+
+    for (int i = 1; i < ARENA_COUNT; i++)
+    {
+        pthread_mutex_lock(&arenas[i].lock);
+        arena_reset(&arenas[i]);
+        pthread_mutex_unlock(&arenas[i].lock);
+    }
+    /*slots cached by any thread belong to the old heap now*/
+    mm_heap_generation++;
+    sample_reset();
+    guard_reset();
+
+    pthread_mutex_lock(&arenas[0].lock);
+    arena_reset(&arenas[0]);
+    ok = arena_init(&arenas[0]);
+    pthread_mutex_unlock(&arenas[0].lock);
+    return ok;
+}
+
+/*
+ * malloc: returns a payload of at least size bytes, in sampling mode
+ *     about one request per sample_interval bytes is sampled and in
+ *     guard mode about one request in guard_interval is guarded
+ */
+void *malloc(size_t size) 
+{
+    void *bp;
+
+    stats_count_malloc(size, 1);
+    /*unsampled requests only count down*/
+    if (size < mm_tcache.sample_left)
+        mm_tcache.sample_left -= size;
+    else if (sample_arm(size))
+        return sample_malloc(size);
+    if (mm_tcache.guard_left > 1)
+        mm_tcache.guard_left--;
+    else if (guard_arm(size) && (bp = guard_malloc(size)) != NULL)
+        return bp;
+    return alloc_payload(size);
+}
+
+/*
+ * alloc_payload: malloc without the counting and sampling. Small
+ *     requests are served by the thread cache when it has a slot,
+ *     everything else goes to heap_malloc under the arena lock.
+ */
+static void *alloc_payload(size_t size)
+{
+    arena_t *arena;
+    void *bp;
+
+    if (size != 0 && size <= slab_max_size)
+    {
+        bp = tcache_alloc(get_slab_class(size));
+        if (bp != NULL)
+            return bp;
+    }
+
+    /*big requests never touch an arena*/
+    if (size >= __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED))
+        return mmap_alloc(size, dsize);
+
+    arena = get_thread_arena();
+    pthread_mutex_lock(&arena->lock);
+    bp = heap_malloc(arena, size);
+    pthread_mutex_unlock(&arena->lock);
+    return bp;
+}
+
+/*
+ * heap_malloc: allocates from the heap of an arena,
+ *     requires the arena lock
+ */
+static void *heap_malloc(arena_t *arena, size_t size)
+{
+    //dbg_printf("malloc start: \n");
+    //mm_printheap();
+    size_t asize;      // Adjusted block size
+    block_t *block;
+    void *bp = NULL;
+
+    if (arena->heap_start == NULL) // Initialize heap if it isn't initialized
+    {
+        if (!arena_init(arena))
+            return NULL;
+    }
+    dbg_requires(check_arena(arena, __LINE__));
+    check_on_op(arena);
+    /*blocks other threads freed are reused before the heap grows*/
+    drain_remote_frees(arena);
+
+    if (size == 0) // Ignore spurious request
+    {
+        dbg_ensures(check_arena(arena, __LINE__));
+        return bp;
+    }
+
+    /*small requests go to a slab page and take no header at all,
+        a batch of extra slots is left in the thread cache*/
+    if (size <= slab_max_size)
+    {
+        bp = tcache_refill(arena, get_slab_class(size));
+        dbg_ensures(check_arena(arena, __LINE__));
+        return bp;
+    }
+
+    // Adjust block size to include overhead and to meet alignment requirements
+    asize = get_asize(size);
+    if (asize == 0) // too big to ever fit
+    {
+        return bp;
+    }
+  
+    //a quick bin of exactly this size needs no search at all
+    block = quick_alloc(arena, asize);
+    if (block == NULL)
+        block = alloc_block(arena, asize);
+    if (block == NULL) // extend_heap returns an error
+    {
+        return bp;
+    }
+
+    bp = header_to_payload(block);
+    //dbg_printf("malloc end printheap: \n");
+    //mm_printheap();
+    dbg_ensures(check_arena(arena, __LINE__));
+    return bp;
+} 
+
+/*
+ * free: gives a payload returned by malloc back to the allocator
+ */
+void free(void *bp)
+{
+    arena_t *arena;
+
+    if (bp == NULL)
+    {
+        return;
+    }
+    stats_count_free(1);
+
+    /*a guarded payload is quarantined on its own page*/
+    if (is_guard_payload(bp))
+    {
+        guard_free(bp);
+        return;
+    }
+
+    /*slab slots have no header, they go to the thread cache*/
+    if (is_slab_payload(bp))
+    {
+        slot_free(bp, payload_to_slab(bp)->class_index);
+        return;
+    }
+
+    /*an mmap block is its own region and goes back to the OS*/
+    if (is_mmap_payload(bp))
+    {
+        mmap_free(bp);
+        return;
+    }
+
+    /*a block of another arena is queued for its owner
+        instead of waiting for the owner's lock*/
+    arena = payload_to_arena(bp);
+    if (arena != get_thread_arena())
+    {
+        remote_free(arena, bp);
+        return;
+    }
+    pthread_mutex_lock(&arena->lock);
+    check_on_op(arena);
+    free_block(arena, payload_to_header(bp));
+    //an arena whose threads only free still takes back what others queued
+    drain_remote_frees(arena);
+    pthread_mutex_unlock(&arena->lock);
+}
+
+/*
+ * mm_memalign: returns a payload of at least size bytes aligned to
+ *     alignment, which must be a power of two. heap blocks are cut out
+ *     of a bigger free block, the part in front of the aligned payload
+ *     staying free, and are freed and reallocated like any other block.
+ */
+void *mm_memalign(size_t alignment, size_t size)
+{
+    arena_t *arena;
+    size_t asize;
+    block_t *block;
+    void *bp = NULL;
+
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (alignment <= dsize)
+        return malloc(size);
+    if (size == 0)
+        return NULL;
+
+    stats_count_malloc(size, 1);
+    /*slots start sizeof(slab_t) bytes into their page, so every slot
+        of a slot size that alignment divides is aligned.
+        a sampled payload would be a block, so these are never sampled*/
+    if (alignment <= sizeof(slab_t) && round_up(size, alignment) <= slab_max_size)
+        return alloc_payload(round_up(size, alignment));
+
+    if (size >= __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED))
+        return mmap_alloc(size, alignment);
+
+    asize = get_asize(size);
+    //alloc_aligned_block looks for asize + alignment + min_block_size
+    if (asize == 0 || alignment > ((size_t)-1 - asize) / 2)
+        return NULL;
+
+    arena = get_thread_arena();
+    pthread_mutex_lock(&arena->lock);
+    if (arena->heap_start != NULL || arena_init(arena))
+    {
+        drain_remote_frees(arena);
+        block = alloc_aligned_block(arena, asize, alignment);
+        if (block != NULL)
+            bp = header_to_payload(block);
+        dbg_ensures(check_arena(arena, __LINE__));
+    }
+    pthread_mutex_unlock(&arena->lock);
+    dbg_ensures(((uintptr_t)bp & (alignment - 1)) == 0);
+    return bp;
+}
+
+/*
+ * mm_posix_memalign: mm_memalign with the posix_memalign interface,
+ *     alignment must also be a multiple of sizeof(void *)
+ */
+int mm_posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *bp;
+
+    if (alignment == 0 || alignment % sizeof(void *) != 0
+        || (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+    bp = mm_memalign(alignment, size);
+    if (bp == NULL && size != 0)
+        return ENOMEM;
+    *memptr = bp;
+    return 0;
+}
+
+/*
+ * mm_aligned_alloc: mm_memalign with the C11 aligned_alloc interface
+ */
+void *mm_aligned_alloc(size_t alignment, size_t size)
+{
+    return mm_memalign(alignment, size);
+}
+
+#ifndef DRIVER
+/*
+ * The libc names of the aligned allocation functions, so that a program
+ * using this malloc never hands free a block from the libc allocator.
+ */
+void *memalign(size_t alignment, size_t size)
+{
+    return mm_memalign(alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    return mm_posix_memalign(memptr, alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return mm_aligned_alloc(alignment, size);
+}
+#endif /* ndef DRIVER */
+
+/*
+ * mm_free_sized: frees a payload that was allocated for size bytes.
+ *     a slab slot goes to the thread cache of the class size belongs to,
+ *     without reading the slab header; anything else is freed by free.
+ *     aligned payloads are not taken, see mm_ext.h.
+ */
+void mm_free_sized(void *bp, size_t size)
+{
+    if (bp != NULL && size != 0 && size <= slab_max_size && is_slab_payload(bp))
+    {
+        int class_index = get_slab_class(size);
+        dbg_assert(class_index == (int)payload_to_slab(bp)->class_index);
+        stats_count_free(1);
+        slot_free(bp, class_index);
+        return;
+    }
+    dbg_assert(bp == NULL || size <= get_usable_size(bp));
+    free(bp);
+}
+
+/*
+ * realloc: reallocate a given pointer with a given size.
+ *     the block is resized in place when it can shrink, absorb a free
+ *     next block or grow the heap it ends, and moved otherwise.
+ */
+void *realloc(void *ptr, size_t size)
+{
+    //dbg_printf("realloc: \n");
+    arena_t *arena = payload_to_arena(ptr);
+    size_t copysize;
+    size_t asize;
+    void *newptr;
+    bool resized;
+
+    // If size == 0, then free block and return NULL
+    if (size == 0)
+    {
+        free(ptr);
+        return NULL;
+    }
+
+    // If ptr is NULL, then equivalent to malloc
+    if (ptr == NULL)
+    {
+        return malloc(size);
+    }
+
+    /*a guarded payload always moves, nothing else fits on its page*/
+    if (is_guard_payload(ptr))
+        return guard_realloc(ptr, size);
+
+    /*a slot stays put while size keeps its class, so that a sized
+        free can tell the class from the size*/
+    if (is_slab_payload(ptr))
+    {
+        if (size <= slab_max_size
+            && get_slab_class(size) == (int)payload_to_slab(ptr)->class_index)
+            return ptr;
+    }
+    /*an mmap block stays one while it is big enough, mremap never copies.
+        a sampled block always moves, so that free forgets its sample*/
+    else if (is_mmap_payload(ptr))
+    {
+        if (size >= __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED)
+            && !is_sampled_payload(ptr))
+            return mmap_realloc(ptr, size);
+    }
+    else if (!is_sampled_payload(ptr) && (asize = get_asize(size)) != 0)
+    {
+        pthread_mutex_lock(&arena->lock);
+        resized = resize_block(arena, payload_to_header(ptr), asize);
+        pthread_mutex_unlock(&arena->lock);
+        if (resized)
+            return ptr;
+    }
+
+    // Otherwise, proceed with reallocation
+    newptr = malloc(size);
+    // If malloc fails, the original block is left untouched
+    if (newptr == NULL)
+    {
+        return NULL;
+    }
+
+    // Copy the old data
+    //neighbors rewrite the prev_alloc bit of the header under the lock
+    if (is_slab_payload(ptr) || is_mmap_payload(ptr))
+    {
+        copysize = get_usable_size(ptr);
+    }
+    else
+    {
+        pthread_mutex_lock(&arena->lock);
+        copysize = get_usable_size(ptr); // gets size of old payload
+        pthread_mutex_unlock(&arena->lock);
+    }
+    if(size < copysize)
+    {
+        copysize = size;
+    }
+    copy_payload(newptr, ptr, copysize);
+
+    // Free the old block
+    free(ptr);
+
+    return newptr;
+}
+
+/*
+ * mm_mallopt: sets an allocator option, see mm_ext.h
+ */
+int mm_mallopt(int option, size_t value)
+{
+    switch (option)
+    {
+    case MM_OPT_MMAP_THRESHOLD:
+        /*requests at or below slab_max_size always come from slabs*/
+        if (value <= slab_max_size)
+            return 0;
+        __atomic_store_n(&mmap_threshold, value, __ATOMIC_RELAXED);
+        return 1;
+    case MM_OPT_TRIM_THRESHOLD:
+        __atomic_store_n(&trim_threshold, value, __ATOMIC_RELAXED);
+        return 1;
+    case MM_OPT_GROWTH_PERCENT:
+        __atomic_store_n(&growth_percent, value, __ATOMIC_RELAXED);
+        return 1;
+    case MM_OPT_GROWTH_MAX:
+        __atomic_store_n(&growth_max, value, __ATOMIC_RELAXED);
+        return 1;
+    case MM_OPT_PREFAULT_MIN:
+        __atomic_store_n(&prefault_min, value, __ATOMIC_RELAXED);
+        return 1;
+    case MM_OPT_DEFER_COALESCE:
+        if (value > 1)
+            return 0;
+        __atomic_store_n(&defer_coalesce, value == 1, __ATOMIC_RELAXED);
+        return 1;
+    case MM_OPT_HUGEPAGE:
+        if (value > 1)
+            return 0;
+        __atomic_store_n(&hugepage_mode, value == 1, __ATOMIC_RELAXED);
+        return 1;
+    case MM_OPT_SAMPLE_INTERVAL:
+        __atomic_store_n(&sample_interval, value, __ATOMIC_RELAXED);
+        return 1;
+    case MM_OPT_CHECK_BLOCKS:
+        __atomic_store_n(&check_blocks_per_op, value, __ATOMIC_RELAXED);
+        return 1;
+    case MM_OPT_GUARD_INTERVAL:
+        __atomic_store_n(&guard_interval, value, __ATOMIC_RELAXED);
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * mm_malloc_batch: allocates n payloads of size bytes each into out,
+ *     carving as many as possible out of a single free block.
+ *     returns how many payloads were allocated, fewer than n only if
+ *     memory ran out
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void **out)
+{
+    arena_t *arena;
+    size_t count = 0;
+    size_t asize;
+
+    if (size == 0 || n == 0)
+        return 0;
+
+    if (size <= slab_max_size)
+    {
+        int class_index = get_slab_class(size);
+        while (count < n && (out[count] = tcache_alloc(class_index)) != NULL)
+            count++;
+        if (count == n)
+        {
+            stats_count_malloc(size, count);
+            return count;
+        }
+    }
+    else if (size >= __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED))
+    {
+        while (count < n && (out[count] = mmap_alloc(size, dsize)) != NULL)
+            count++;
+        stats_count_malloc(size, count);
+        return count;
+    }
+
+    arena = get_thread_arena();
+    pthread_mutex_lock(&arena->lock);
+    if (arena->heap_start == NULL && !arena_init(arena))
+    {
+        pthread_mutex_unlock(&arena->lock);
+        stats_count_malloc(size, count);
+        return count;
+    }
+    drain_remote_frees(arena);
+
+    if (size <= slab_max_size)
+    {
+        int class_index = get_slab_class(size);
+        while (count < n && (out[count] = slab_alloc(arena, class_index)) != NULL)
+            count++;
+    }
+    else if ((asize = get_asize(size)) != 0)
+    {
+        while (count < n)
+        {
+            /*one free block for the whole rest, or else for one more*/
+            size_t want = (n - count <= (size_t)-1 / asize) ? (n - count) * asize : asize;
+            block_t *block = find_fit(arena, want);
+            if (block == NULL)
+                block = find_fit(arena, asize);
+            if (block == NULL && quick_consolidate(arena))
+                continue;
+            if (block == NULL)
+                block = extend_heap(arena, get_extend_size(arena, want));
+            if (block == NULL)
+                break;
+            count += place_batch(arena, block, asize, n - count, out + count);
+        }
+    }
+    dbg_ensures(check_arena(arena, __LINE__));
+    pthread_mutex_unlock(&arena->lock);
+    stats_count_malloc(size, count);
+    return count;
+}
+
+/*
+ * mm_free_batch: frees n payloads, which reorders ptrs by address.
+ *     neighboring blocks of the heap are merged into one free block
+ *     and coalesced once, all under a single lock of the arena
+ */
+void mm_free_batch(void **ptrs, size_t n)
+{
+    arena_t *arena = get_thread_arena();
+    size_t own = 0;
+    size_t freed = 0;
+
+    /*blocks that need no lock of this arena are freed first*/
+    for (size_t i = 0; i < n; i++)
+    {
+        void *bp = ptrs[i];
+        if (bp == NULL)
+            continue;
+        freed++;
+        if (is_guard_payload(bp))
+            guard_free(bp);
+        else if (is_slab_payload(bp))
+        {
+            if (!tcache_free(bp, payload_to_slab(bp)->class_index))
+                ptrs[own++] = bp;
+        }
+        else if (is_mmap_payload(bp))
+            mmap_free(bp);
+        else if (payload_to_arena(bp) != arena)
+            remote_free(payload_to_arena(bp), bp);
+        else
+            ptrs[own++] = bp;
+    }
+    stats_count_free(freed);
+    if (own == 0)
+        return;
+
+    qsort(ptrs, own, sizeof(void *), compare_address);
+
+    pthread_mutex_lock(&arena->lock);
+    for (size_t i = 0; i < own; i++)
+    {
+        block_t *block;
+        size_t size;
+
+        if (is_slab_payload(ptrs[i]))
+        {
+            int class_index = payload_to_slab(ptrs[i])->class_index;
+            tcache_register();
+            tcache_flush(arena, class_index, tcache_bin_max / 2);
+            tcache_free(ptrs[i], class_index);
+            continue;
+        }
+
+        /*the following payloads of the batch that are right after
+            this block join it, only the first keeps its prev_alloc bit.
+            sampled blocks are freed on their own*/
+        block = payload_to_header(ptrs[i]);
+        size = get_size(block);
+        while (i + 1 < own && !is_slab_payload(ptrs[i + 1])
+               && !is_sampled_payload(header_to_payload(block))
+               && !is_sampled_payload(ptrs[i + 1])
+               && (char *)block + size == (char *)payload_to_header(ptrs[i + 1]))
+        {
+            i++;
+            size += get_size(payload_to_header(ptrs[i]));
+        }
+        if (size != get_size(block))
+        {
+            write_header(block, size, get_prev_alloc(block), true);
+            check_cursor_merged(arena, block, size);
+        }
+        free_block(arena, block);
+    }
+    drain_remote_frees(arena);
+    dbg_ensures(check_arena(arena, __LINE__));
+    pthread_mutex_unlock(&arena->lock);
+}
+
+/*
+ * mm_region_create: returns a new empty region, NULL if out of memory.
+ *     a region is not thread-safe, each thread should use its own.
+ */
+mm_region_t *mm_region_create(void)
 {
-    //dbg_printf("realloc: \n");
-    block_t *block = payload_to_header(ptr);
-    size_t copysize;
-    void *newptr;
+    mm_region_t *region = malloc(sizeof(mm_region_t));
+
+    if (region == NULL)
+        return NULL;
+    region->first = NULL;
+    region->current = NULL;
+    region->cursor = NULL;
+    region->chunk_size = region_chunk_min;
+    return region;
+}
+
+/*
+ * mm_region_alloc: returns size bytes from a region, which stay valid
+ *     until the region is reset or destroyed
+ */
+void *mm_region_alloc(mm_region_t *region, size_t size)
+{
+    region_chunk_t *chunk;
+    void *bp;
+
+    if (size == 0 || size > (size_t)-1 - region_chunk_max)
+        return NULL;
+    size = round_up(size, dsize);
+
+    if (region->current == NULL
+        || size > (size_t)(region->current->end - region->cursor))
+    {
+        //chunks left from before a reset are used again in order
+        chunk = (region->current != NULL) ? region->current->next : region->first;
+        if (chunk == NULL || size > (size_t)(chunk->end - chunk->data))
+        {
+            size_t chunk_size = max(region->chunk_size, size + sizeof(region_chunk_t));
+            region_chunk_t *new_chunk = malloc(chunk_size);
+            if (new_chunk == NULL)
+                return NULL;
+            new_chunk->end = (char *)new_chunk + chunk_size;
+            new_chunk->next = chunk;
+            if (region->current != NULL)
+                region->current->next = new_chunk;
+            else
+                region->first = new_chunk;
+            chunk = new_chunk;
+            region->chunk_size = min(region->chunk_size * 2, region_chunk_max);
+        }
+        region->current = chunk;
+        region->cursor = chunk->data;
+    }
+
+    bp = region->cursor;
+    region->cursor += size;
+    return bp;
+}
+
+/*
+ * mm_region_reset: frees everything allocated from a region at once.
+ *     the chunks are kept for the next allocations, so this is O(1).
+ */
+void mm_region_reset(mm_region_t *region)
+{
+    region->current = NULL;
+    region->cursor = NULL;
+}
+
+/*
+ * mm_region_destroy: frees a region and everything allocated from it,
+ *     giving each of its chunks back to the heap
+ */
+void mm_region_destroy(mm_region_t *region)
+{
+    region_chunk_t *chunk;
+
+    if (region == NULL)
+        return;
+    chunk = region->first;
+    while (chunk != NULL)
+    {
+        region_chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(region);
+}
+
+/*
+ * mm_trim: gives the free memory at the end of each arena's heap back
+ *     to the OS, keeping pad bytes of it.
+ *     returns 1 if any memory was released and 0 otherwise
+ */
+int mm_trim(size_t pad)
+{
+    int released = 0;
+
+    for (int i = 0; i < ARENA_COUNT; i++)
+    {
+        arena_t *arena = &arenas[i];
+        pthread_mutex_lock(&arena->lock);
+        if (arena->heap_start != NULL)
+        {
+            /*queued frees and quick bins may free the end of the heap*/
+            drain_remote_frees(arena);
+            quick_consolidate(arena);
+            if (arena_trim(arena, pad))
+                released = 1;
+        }
+        pthread_mutex_unlock(&arena->lock);
+    }
+    return released;
+}
+
+/*
+ * mm_decommit: gives the pages inside every free block of at least
+ *     min_size bytes back to the OS. the blocks stay where they are and
+ *     get their pages back zeroed when they are used again.
+ *     returns how many bytes were released
+ */
+size_t mm_decommit(size_t min_size)
+{
+    size_t released = 0;
+
+    for (int i = 0; i < ARENA_COUNT; i++)
+    {
+        arena_t *arena = &arenas[i];
+        pthread_mutex_lock(&arena->lock);
+        if (arena->heap_start != NULL)
+        {
+            /*free blocks are only merged once they reach the index*/
+            drain_remote_frees(arena);
+            quick_consolidate(arena);
+            released += arena_decommit(arena, min_size);
+        }
+        pthread_mutex_unlock(&arena->lock);
+    }
+    return released;
+}
+
+/*
+ * mm_stats: adds up the counters of every live thread, of the threads
+ *     that exited and of every arena into a snapshot
+ */
+void mm_stats(mm_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    pthread_mutex_lock(&stats_lock);
+    stats_merge(stats, &stats_exited);
+    for (tcache_t *t = stats_threads; t != NULL; t = t->stats_next)
+        stats_merge(stats, &t->stats);
+    pthread_mutex_unlock(&stats_lock);
+
+    for (int i = 0; i < ARENA_COUNT; i++)
+    {
+        arena_t *arena = &arenas[i];
+        pthread_mutex_lock(&arena->lock);
+        if (arena->heap_start != NULL)
+        {
+            stats->heap_bytes += arena_heap_size(arena);
+            stats->free_bytes += arena->stats.free_bytes + arena->stats.quick_bytes;
+        }
+        stats->fit_searches += arena->stats.fit_searches;
+        stats->fit_probes += arena->stats.fit_probes;
+        stats->splits += arena->stats.splits;
+        stats->coalesces += arena->stats.coalesces;
+        stats->extends += arena->stats.extends;
+        pthread_mutex_unlock(&arena->lock);
+    }
+    stats->in_use_bytes = stats->heap_bytes - stats->free_bytes;
+    stats->mmap_bytes = __atomic_load_n(&mmap_bytes, __ATOMIC_RELAXED);
+}
+
+/*
+ * mm_profile_dump: writes one line per live sample with the size it
+ *     asked for and its stack, then the memory map of the process so
+ *     that pprof can find the code behind the addresses. the sample
+ *     rate in the header lets pprof scale the samples back up.
+ *     formats into a buffer on the stack, so nothing is allocated, and
+ *     frees of sampled payloads wait for it.
+ */
+int mm_profile_dump(int fd)
+{
+    char buf[4096];
+    size_t len = 0;
+    size_t count = 0;
+    size_t bytes = 0;
+    int maps;
+    ssize_t n;
+    int err = 0;
+
+    pthread_mutex_lock(&sample_lock);
+    for (int i = 0; sample_table != NULL && i < SAMPLE_TABLE_SIZE; i++)
+    {
+        for (sample_t *sample = sample_table[i]; sample != NULL; sample = sample->next)
+        {
+            count++;
+            bytes += sample->size;
+        }
+    }
+    len = snprintf(buf, sizeof(buf), "heap profile: %zu: %zu [ %zu: %zu] @ heap_v2/%zu\n",
+                   count, bytes, count, bytes,
+                   __atomic_load_n(&sample_interval, __ATOMIC_RELAXED));
+
+    for (int i = 0; sample_table != NULL && i < SAMPLE_TABLE_SIZE && err == 0; i++)
+    {
+        for (sample_t *sample = sample_table[i]; sample != NULL && err == 0;
+             sample = sample->next)
+        {
+            //a full line is at most 19 bytes per frame plus the counts
+            if (sizeof(buf) - len < 64 + SAMPLE_MAX_DEPTH * 19)
+            {
+                err = write_all(fd, buf, len);
+                len = 0;
+            }
+            len += snprintf(buf + len, sizeof(buf) - len, "1: %zu [1: %zu] @",
+                            sample->size, sample->size);
+            for (int d = 0; d < sample->depth; d++)
+                len += snprintf(buf + len, sizeof(buf) - len, " %p", sample->stack[d]);
+            buf[len++] = '\n';
+        }
+    }
+    pthread_mutex_unlock(&sample_lock);
+
+    len += snprintf(buf + len, sizeof(buf) - len, "\nMAPPED_LIBRARIES:\n");
+    if (err == 0)
+        err = write_all(fd, buf, len);
+    maps = open("/proc/self/maps", O_RDONLY);
+    if (maps < 0)
+        return err;
+    while (err == 0 && (n = read(maps, buf, sizeof(buf))) > 0)
+        err = write_all(fd, buf, n);
+    close(maps);
+    return err;
+}
+
+/*
+ * calloc: returns a zeroed payload for elements objects of size bytes.
+ *     mmap regions and the part of a block that lies past the zero_from
+ *     mark of its arena are zero already, so only the rest is cleared.
+ */
+void *calloc(size_t elements, size_t size)
+{
+    //dbg_printf("calloc: \n");
+    arena_t *arena;
+    void *bp;
+    bool zero;
+    char *from;
+    size_t asize = elements * size;
+
+    if (elements != 0 && asize/elements != size)
+    {    
+        // Multiplication overflowed
+        return NULL;
+    }
+
+    if (asize <= slab_max_size)
+    {
+        bp = malloc(asize);
+        if (bp != NULL)
+            memset(bp, 0, asize);
+        return bp;
+    }
+
+    stats_count_malloc(asize, 1);
+    if (asize < mm_tcache.sample_left)
+        mm_tcache.sample_left -= asize;
+    else if (sample_arm(asize))
+    {
+        bp = sample_malloc(asize);
+        if (bp != NULL)
+            fill_zero(bp, asize);
+        return bp;
+    }
+    /*a guarded page comes zeroed*/
+    if (mm_tcache.guard_left > 1)
+        mm_tcache.guard_left--;
+    else if (guard_arm(asize) && (bp = guard_malloc(asize)) != NULL)
+        return bp;
+
+    /*a new mmap region comes zeroed from the OS*/
+    if (asize >= __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED))
+        return mmap_alloc(asize, dsize);
+
+    arena = get_thread_arena();
+    pthread_mutex_lock(&arena->lock);
+    arena->zero_alloc = NULL;
+    bp = heap_malloc(arena, asize);
+    zero = bp != NULL && arena->zero_alloc == payload_to_header(bp);
+    from = arena->zero_alloc_from;
+    pthread_mutex_unlock(&arena->lock);
+    if (bp == NULL)
+    {
+        return NULL;
+    }
+
+    // Initialize all bits to 0
+    if (zero)
+    {
+        //the part before the zero memory and a footer left at the end
+        block_t *block = payload_to_header(bp);
+        if (from > (char *)bp)
+            fill_zero(bp, min(from - (char *)bp, asize));
+        *(word_t *)((char *)block + get_size(block) - wsize) = 0;
+    }
+    else
+        fill_zero(bp, asize);
+
+    return bp;
+}
+
+/******** The remaining content below are helper and debug routines ********/
+
+/*
+ * extend_heap: extends the heap when there is no free block in heap 
+ *     that is big enough to allocate the given size
+ */
+static block_t *extend_heap(arena_t *arena, size_t size) 
+{
+    void *bp;
+
+    // Allocate an even number of words to maintain alignment
+    size = round_up(size, dsize);
+    if ((bp = arena_sbrk(arena, size)) == (void *)-1)
+    {
+        return NULL;
+    }
+    arena->stats.extends++;
+
+    /*fault the pages of a big extension in now, in one system call*/
+    prefault(bp, size - wsize);
+    
+    // Initialize free block header/footer 
+    block_t *block = payload_to_header(bp);
+    /*write new header and footer for the block*/
+    write_header(block, size, get_prev_alloc(block), false);
+    write_footer(block, size, get_prev_alloc(block), false);
+    /*set its next and prev to null because it's a new free block*/
+    block->next = NULL;
+    block->prev = NULL;
+    // Create new epilogue header
+    block_t *block_next = find_next(block);
+    write_header(block_next, 0, false, true);
+    //dbg_printf("extend heap: \n");
+    //the pages above the break of an mmap slice were never written
+    if (!arena_uses_sbrk(arena) && arena->zero_from == NULL)
+        arena->zero_from = (char *)bp + dsize;
+    else if (!arena_uses_sbrk(arena))
+    {
+        //the old footer and the new header are now inside the zero part
+        block = coalesce(arena, block);
+        *((word_t *)bp - 2) = 0;
+        *((word_t *)bp - 1) = 0;
+        return block;
+    }
+    // Coalesce in case the previous block was free
+    return coalesce(arena, block);
+}
+
+/*
+ * get_extend_size: returns how much to grow the heap of an arena by
+ *     when no free block can hold asize bytes
+ */
+static size_t get_extend_size(arena_t *arena, size_t asize)
+{
+    size_t grow = arena_heap_size(arena) / 100
+                  * __atomic_load_n(&growth_percent, __ATOMIC_RELAXED);
+
+    grow = min(grow, __atomic_load_n(&growth_max, __ATOMIC_RELAXED));
+    return max(asize, max(grow, policy.chunksize));
+}
+
+/*
+ * alloc_block: finds or makes a free block of asize bytes and places it,
+ *     returns NULL if the heap cannot be extended
+ */
+static block_t *alloc_block(arena_t *arena, size_t asize)
+{
+    size_t extendsize; // Amount to extend heap if no fit is found
+    block_t *block;
+
+    // Search the free list for a fit
+    block = find_fit(arena, asize);
+    if (block == NULL && quick_consolidate(arena))
+        block = find_fit(arena, asize);
+
+    // If no fit is found, request more memory, and then and place the block
+    if (block == NULL)
+    {  
+        extendsize = get_extend_size(arena, asize);
+        block = extend_heap(arena, extendsize);
+        if (block == NULL) // extend_heap returns an error
+        {
+            return NULL;
+        }
+
+    }
+
+    place(arena, block, asize);
+    return block;
+}
+
+/*
+ * alloc_aligned_block: like alloc_block, but the payload of the block is
+ *     aligned to align bytes (a power of two). The space in front of the
+ *     aligned payload is split off as a free block of its own.
+ */
+static block_t *alloc_aligned_block(arena_t *arena, size_t asize, size_t align)
+{
+    /*enough room to move the payload up to align plus a leading block*/
+    size_t search_size = asize + align + min_block_size;
+    size_t size, offset;
+    uintptr_t bp;
+    block_t *block = find_fit(arena, search_size);
+
+    if (block == NULL && quick_consolidate(arena))
+        block = find_fit(arena, search_size);
+    if (block == NULL)
+    {
+        block = extend_heap(arena, get_extend_size(arena, search_size));
+        if (block == NULL)
+            return NULL;
+    }
+
+    bp = (uintptr_t)header_to_payload(block);
+    offset = round_up(bp, align) - bp;
+    //the leading part must be big enough to be a free block
+    while (offset != 0 && offset < min_block_size)
+        offset += align;
+
+    if (offset != 0)
+    {
+        /*split the free block into the leading part and the aligned part*/
+        size = get_size(block);
+        fl_remove(arena, block);
+        write_header(block, offset, get_prev_alloc(block), false);
+        write_footer(block, offset, get_prev_alloc(block), false);
+        fl_insert(arena, block);
+
+        block = find_next(block);
+        write_header(block, size - offset, false, false);
+        write_footer(block, size - offset, false, false);
+        fl_insert(arena, block);
+        //the new footer and header may be in the zero part
+        if (arena->zero_from != NULL && (char *)header_to_payload(block) + dsize > arena->zero_from)
+            arena->zero_from = (char *)header_to_payload(block) + dsize;
+        arena->stats.splits++;
+    }
+
+    place(arena, block, asize);
+    return block;
+}
+
+/*
+ * free_block: frees an allocated block, into a quick bin in deferred
+ *     coalescing mode and by release_block otherwise
+ */
+static void free_block(arena_t *arena, block_t *block)
+{
+    /*a sampled block is not live anymore*/
+    if (block->header & sampled_mask)
+    {
+        sample_remove(header_to_payload(block));
+        write_header(block, get_size(block), get_prev_alloc(block), true);
+    }
+    if (!quick_free(arena, block))
+        release_block(arena, block);
+}
+
+/*
+ * release_block: frees an allocated block and coalesces it with its neighbors
+ */
+static void release_block(arena_t *arena, block_t *block)
+{
+    size_t size = get_size(block);
+
+    /*write new header and footer to the block to free it*/
+    write_header(block, size, get_prev_alloc(block), false);
+    write_footer(block, size, get_prev_alloc(block), false);
+
+    /*set the block's prev and next to null because it is a new free block*/
+    block->prev = NULL;
+    block->next = NULL;
+    /*coalesce the new free block*/
+    block = coalesce(arena, block);
+
+    /*a big free block at the end of the heap goes back to the OS*/
+    if (get_size(block) >= __atomic_load_n(&trim_threshold, __ATOMIC_RELAXED)
+        && get_size(find_next(block)) == 0)
+    {
+        arena_trim(arena, get_extend_size(arena, 0));
+    }
+}
+
+/*
+ * quick_free: puts a block in its quick bin without changing its header,
+ *     returns false if the block has to be freed normally
+ */
+static bool quick_free(arena_t *arena, block_t *block)
+{
+    size_t size = get_size(block);
+
+    if (size > quick_max_size || !__atomic_load_n(&defer_coalesce, __ATOMIC_RELAXED))
+        return false;
+    block->next = arena->quick_bins[size / dsize];
+    arena->quick_bins[size / dsize] = block;
+    arena->stats.quick_bytes += size;
+    /*too many blocks wait for coalescing, do them all now*/
+    if (++arena->quick_count >= quick_max_count)
+        quick_consolidate(arena);
+    return true;
+}
+
+/*
+ * quick_alloc: takes a block of exactly asize bytes from its quick bin,
+ *     returns NULL if there is none
+ */
+static block_t *quick_alloc(arena_t *arena, size_t asize)
+{
+    block_t *block;
+
+    if (asize > quick_max_size || arena->quick_bins[asize / dsize] == NULL)
+        return NULL;
+    block = arena->quick_bins[asize / dsize];
+    arena->quick_bins[asize / dsize] = block->next;
+    arena->quick_count--;
+    arena->stats.quick_bytes -= asize;
+    return block;
+}
+
+/*
+ * quick_consolidate: frees and coalesces every block of the quick bins,
+ *     returns false if the bins were empty
+ */
+static bool quick_consolidate(arena_t *arena)
+{
+    if (arena->quick_count == 0)
+        return false;
+    for (int i = 0; i < QUICK_BIN_COUNT; i++)
+    {
+        while (arena->quick_bins[i] != NULL)
+        {
+            block_t *block = arena->quick_bins[i];
+            arena->quick_bins[i] = block->next;
+            release_block(arena, block);
+        }
+    }
+    arena->quick_count = 0;
+    arena->stats.quick_bytes = 0;
+    return true;
+}
+
+/*
+ * resize_block: changes the size of an allocated block to asize without
+ *     moving it. a shrinking block gives its tail back the way place
+ *     splits, a growing block absorbs a free next block, and a block at
+ *     the end of the heap extends the heap just enough first.
+ *     returns false if the block has to move.
+ */
+static bool resize_block(arena_t *arena, block_t *block, size_t asize)
+{
+    size_t csize = get_size(block);
+    block_t *block_next = find_next(block);
+    size_t available = csize;
 
-    // If size == 0, then free block and return NULL
-    if (size == 0)
+    if (!get_alloc(block_next))
+        available += get_size(block_next);
+
+    if (available < asize)
     {
-        free(ptr);
-        return NULL;
+        //only a block that ends the heap (maybe through its free
+        //  next block) can get more room from extend_heap
+        block_t *last = get_alloc(block_next) ? block_next : find_next(block_next);
+        if (get_size(last) != 0)
+            return false;
+        if (extend_heap(arena, max(asize - available, min_block_size)) == NULL)
+            return false;
+        /*the extension is coalesced with a free next block if there was one*/
+        block_next = find_next(block);
+        available = csize + get_size(block_next);
     }
 
-    // If ptr is NULL, then equivalent to malloc
-    if (ptr == NULL)
+    if (available != csize)
     {
-        return malloc(size);
+        /*the free next block becomes part of the block*/
+        fl_remove(arena, block_next);
+        check_cursor_merged(arena, block, available);
+        if (arena->zero_from != NULL && (char *)block + available > arena->zero_from)
+            arena->zero_from = NULL;
+        if (arena->top_released != NULL && (char *)block + asize > arena->top_released)
+            arena->top_released = NULL;
     }
 
-    // Otherwise, proceed with reallocation
-    newptr = malloc(size);
-    // If malloc fails, the original block is left untouched
-    if (newptr == NULL)
+    //split the tail off if it is big enough to be a free block
+    if (available - asize >= policy.split_min)
     {
-        return NULL;
+        write_header(block, asize, get_prev_alloc(block), true);
+        block_next = find_next(block);
+        write_header(block_next, available - asize, true, false);
+        write_footer(block_next, available - asize, true, false);
+        block_next->prev = NULL;
+        block_next->next = NULL;
+        coalesce(arena, block_next);
+        arena->stats.splits++;
     }
-
-    // Copy the old data
-    copysize = get_payload_size(block); // gets size of old payload
-    if(size < copysize)
+    else if (available != csize)
     {
-        copysize = size;
+        write_header(block, available, get_prev_alloc(block), true);
+        set_next_prev_alloc(block, true);
     }
-    memcpy(newptr, ptr, copysize);
+    return true;
+}
 
-    // Free the old block
-    free(ptr);
+/*
+ * get_asize: returns the block size for a payload of size bytes,
+ *     the header is added and the size rounded up to dsize.
+ *     returns 0 if the block size does not fit in a size_t.
+ */
+static size_t get_asize(size_t size)
+{
+    if (size > (size_t)-1 - dsize - wsize)
+        return 0;
+    /*add only the header size to the given size 
+          because it will be allocated and we removed footer for allocated blocks*/
+    return max(round_up(size + wsize, dsize), min_block_size);
+}
 
-    return newptr;
+/*
+ * get_usable_size: returns how many bytes the caller may use at bp,
+ *     which is the slot size for slab slots
+ */
+static size_t get_usable_size(void *bp)
+{
+    if (is_guard_payload(bp))
+        return guard_payload_size(bp);
+    if (is_slab_payload(bp))
+        return payload_to_slab(bp)->slot_size;
+    if (is_mmap_payload(bp))
+        return get_size(payload_to_header(bp)) - get_mmap_offset(bp);
+    return get_payload_size(payload_to_header(bp));
 }
 
 /*
- * <what does calloc do?>
+ * fill_zero: zeroes size bytes at the 16 byte aligned bp, bypassing the
+ *     cache for big sizes
  */
-void *calloc(size_t elements, size_t size)
+static void fill_zero(void *bp, size_t size)
 {
-    //dbg_printf("calloc: \n");
-    void *bp;
-    size_t asize = elements * size;
+#ifdef __SSE2__
+    if (size >= nontemporal_min)
+    {
+        __m128i zero = _mm_setzero_si128();
+        char *p = bp;
+        char *end = p + size;
 
-    if (asize/elements != size)
-    {    
-        // Multiplication overflowed
-        return NULL;
+        for (; p + 64 <= end; p += 64)
+        {
+            _mm_stream_si128((__m128i *)p, zero);
+            _mm_stream_si128((__m128i *)(p + 16), zero);
+            _mm_stream_si128((__m128i *)(p + 32), zero);
+            _mm_stream_si128((__m128i *)(p + 48), zero);
+        }
+        //streaming stores are weakly ordered, finish them before returning
+        _mm_sfence();
+        memset(p, 0, end - p);
+        return;
     }
-    
-    bp = malloc(asize);
-    if (bp == NULL)
+#endif
+    memset(bp, 0, size);
+}
+
+/*
+ * copy_payload: copies size bytes between 16 byte aligned payloads,
+ *     bypassing the cache for the destination of big copies
+ */
+static void copy_payload(void *dst, const void *src, size_t size)
+{
+#ifdef __SSE2__
+    if (size >= nontemporal_min)
     {
-        return NULL;
+        char *d = dst;
+        const char *s = src;
+        char *end = d + size;
+
+        for (; d + 64 <= end; d += 64, s += 64)
+        {
+            __m128i a = _mm_load_si128((const __m128i *)s);
+            __m128i b = _mm_load_si128((const __m128i *)(s + 16));
+            __m128i c = _mm_load_si128((const __m128i *)(s + 32));
+            __m128i e = _mm_load_si128((const __m128i *)(s + 48));
+            _mm_stream_si128((__m128i *)d, a);
+            _mm_stream_si128((__m128i *)(d + 16), b);
+            _mm_stream_si128((__m128i *)(d + 32), c);
+            _mm_stream_si128((__m128i *)(d + 48), e);
+        }
+        _mm_sfence();
+        memcpy(d, s, end - d);
+        return;
     }
-    // Initialize all bits to 0
-    memset(bp, 0, asize);
+#endif
+    memcpy(dst, src, size);
+}
+
+/*
+ * mmap_alloc: maps a region of its own for a big request whose payload
+ *     is aligned to align bytes (a power of two, at least dsize)
+ */
+static void *mmap_alloc(size_t size, size_t align)
+{
+    /*room for the offset word and the header in front of the payload,
+        and for moving it up to align when mmap only aligns to a page*/
+    size_t extra = round_up(dsize, align) + (align > page_size ? align - page_size : 0);
+    size_t length;
+    char *region;
+    char *bp;
 
+    if (extra < align || size > (size_t)-1 - page_size - extra)
+        return NULL;
+    length = round_up(size + extra, page_size);
+    region = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED)
+        return NULL;
+
+    bp = (char *)round_up((uintptr_t)region + dsize, align);
+    *((word_t *)bp - 2) = bp - region;
+    payload_to_header(bp)->header = pack(length, true, true) | mmap_mask;
+    __atomic_fetch_add(&mmap_bytes, length, __ATOMIC_RELAXED);
     return bp;
 }
 
-/******** The remaining content below are helper and debug routines ********/
+/*
+ * mmap_free: unmaps the region of an mmap block
+ */
+static void mmap_free(void *bp)
+{
+    size_t length = get_size(payload_to_header(bp));
+
+    if (payload_to_header(bp)->header & sampled_mask)
+        sample_remove(bp);
+    __atomic_fetch_sub(&mmap_bytes, length, __ATOMIC_RELAXED);
+    munmap((char *)bp - get_mmap_offset(bp), length);
+}
 
 /*
- * extend_heap: extends the heap when there is no free block in heap 
- *     that is big enough to allocate the given size
+ * mmap_realloc: resizes the region of an mmap block with mremap,
+ *     which moves the pages instead of copying them
  */
-static block_t *extend_heap(size_t size) 
+static void *mmap_realloc(void *bp, size_t size)
 {
-    void *bp;
+    size_t offset = get_mmap_offset(bp);
+    size_t old_length = get_size(payload_to_header(bp));
+    size_t length;
+    char *region;
 
-    // Allocate an even number of words to maintain alignment
-    size = round_up(size, dsize);
-    if ((bp = mem_sbrk(size)) == (void *)-1)
-    {
+    if (size > (size_t)-1 - page_size - offset)
         return NULL;
-    }
-    
-    // Initialize free block header/footer 
-    block_t *block = payload_to_header(bp);
-    /*write new header and footer for the block*/
-    write_header(block, size, get_prev_alloc(block), false);
-    write_footer(block, size, get_prev_alloc(block), false);
-    /*set its next and prev to null because it's a new free block*/
-    block->next = NULL;
-    block->prev = NULL;
-    // Create new epilogue header
-    block_t *block_next = find_next(block);
-    write_header(block_next, 0, false, true);
-    //dbg_printf("extend heap: \n");
-    // Coalesce in case the previous block was free
-    return coalesce(block);
+    length = round_up(size + offset, page_size);
+    if (length == old_length)
+        return bp;
+    region = mremap((char *)bp - offset, old_length, length, MREMAP_MAYMOVE);
+    if (region == MAP_FAILED)
+        return NULL;
+
+    bp = region + offset;
+    payload_to_header(bp)->header = pack(length, true, true) | mmap_mask;
+    __atomic_fetch_add(&mmap_bytes, length - old_length, __ATOMIC_RELAXED);
+    return bp;
+}
+
+/*
+ * is_mmap_payload: returns true when a payload is an mmap block.
+ *     safe without any lock, neighbors only rewrite the prev_alloc bit
+ *     of heap block headers.
+ */
+static bool is_mmap_payload(void *bp)
+{
+    return __atomic_load_n(&payload_to_header(bp)->header, __ATOMIC_RELAXED)
+           & mmap_mask;
+}
+
+/*
+ * get_mmap_offset: returns how far the payload of an mmap block is
+ *     from the start of its region
+ */
+static size_t get_mmap_offset(void *bp)
+{
+    return *((word_t *)bp - 2);
 }
 
 /*
  * coalesce: combine consecutive free blocks to save memory usage
  */
-static block_t *coalesce(block_t * block) 
+static block_t *coalesce(arena_t *arena, block_t * block) 
 {
     block_t * next_block = find_next(block);
     bool next_alloc = get_alloc(next_block);
@@ -456,19 +3397,20 @@ static block_t *coalesce(block_t * block)
         set_next_prev_alloc(block, false);
         //set_next_prev_alloc_footer(block, false);
         /*put the block into freelist*/
-        fl_insert(block);
+        fl_insert(arena, block);
         
         //mm_printfreelist();
         //dbg_printf("Coalecse case 1 end: \n");
         //mm_printheap();
         return block;
     }
-    else if (prev_alloc && !next_alloc) { /* Case 2 */
+    if (prev_alloc && !next_alloc) { /* Case 2 */
         //remove next block from freelist because it's combined with current block
         //dbg_printf("Coalecse case 2 start: \n");
         //mm_printheap();
-        fl_remove(next_block); /* remove next block from freelist */
+        fl_remove(arena, next_block); /* remove next block from freelist */
         size += get_size(next_block); /*add the sizes together*/
+        arena->stats.coalesces++;
         /*write new header and new footer to combine the two blocks*/
         write_header(block, size, true, false);
         write_footer(block, size, true, false);
@@ -478,8 +3420,9 @@ static block_t *coalesce(block_t * block)
         //remove prev block from freelist because it's combined with current block
         //dbg_printf("Coalecse case 3 start: \n");
         //mm_printheap();
-        fl_remove(find_prev(block)); /* remove prev block from freelist */
+        fl_remove(arena, find_prev(block)); /* remove prev block from freelist */
         size += get_size(find_prev(block)); /*add the sizes together*/
+        arena->stats.coalesces++;
         /*write new header and new footer to combine the two blocks*/
         write_footer(block, size, get_prev_alloc(find_prev(block)), false);
         write_header(find_prev(block), size, get_prev_alloc(find_prev(block)), false);
@@ -492,9 +3435,10 @@ static block_t *coalesce(block_t * block)
         //  because they are combined with current block
         //dbg_printf("Coalecse case 4 start: \n");
         //mm_printheap();
-        fl_remove(next_block); /* remove next block from freelist */
-        fl_remove(find_prev(block)); /* remove prev block from freelist */
+        fl_remove(arena, next_block); /* remove next block from freelist */
+        fl_remove(arena, find_prev(block)); /* remove prev block from freelist */
         size += get_size(find_prev(block)) + get_size(next_block); /* add the total size*/
+        arena->stats.coalesces += 2;
         /*write the header and the footer to combine the three blocks*/
         write_header(find_prev(block), size, get_prev_alloc(find_prev(block)), false);
         write_footer(next_block, size, get_prev_alloc(find_prev(block)), false);
@@ -503,90 +3447,380 @@ static block_t *coalesce(block_t * block)
         
     }
 
-    /*set the prev_alloc bit of the next block to true*/
-    set_next_prev_alloc(block, false);
-    //set_next_prev_alloc_footer(block, false);
-
-    /*insert the current block to the freelist*/
-    fl_insert(block);
-    //dbg_printf("Coalecse case 2-4 end: \n");
-    //mm_printheap();
-    return block;
+    /*set the prev_alloc bit of the next block to true*/
+    set_next_prev_alloc(block, false);
+    //set_next_prev_alloc_footer(block, false);
+    check_cursor_merged(arena, block, size);
+
+    /*insert the current block to the freelist*/
+    fl_insert(arena, block);
+    //dbg_printf("Coalecse case 2-4 end: \n");
+    //mm_printheap();
+    return block;
+}
+
+/*
+ * prefault: faults the pages of size bytes from start in with one system
+ *     call if there are at least prefault_min bytes, instead of one page
+ *     fault per page when they are first written
+ */
+static void prefault(void *start, size_t size)
+{
+#ifdef MADV_POPULATE_WRITE
+    size_t min = __atomic_load_n(&prefault_min, __ATOMIC_RELAXED);
+    if (min != 0 && size >= min)
+    {
+        uintptr_t first = round_up((uintptr_t)start, page_size);
+        uintptr_t end = ((uintptr_t)start + size) & ~(uintptr_t)(page_size - 1);
+        if (end > first)
+            madvise((void *)first, end - first, MADV_POPULATE_WRITE);
+    }
+#else
+    (void)start;
+    (void)size;
+#endif
+}
+
+/*
+ * check_cursor_merged: the block headers inside the size bytes from
+ *     block are gone, so a check_cursor at one of them moves to block
+ */
+static void check_cursor_merged(arena_t *arena, block_t *block, size_t size)
+{
+    char *cursor = (char *)arena->check_cursor;
+    if (cursor > (char *)block && cursor < (char *)block + size)
+        arena->check_cursor = block;
+}
+
+/*
+ * check_on_op: checks the next MM_OPT_CHECK_BLOCKS blocks of the heap and
+ *     aborts if they are corrupted, while the damage is still close to
+ *     the operation that caused it. requires the arena lock
+ */
+static void check_on_op(arena_t *arena)
+{
+    size_t budget = __atomic_load_n(&check_blocks_per_op, __ATOMIC_RELAXED);
+    if (budget != 0 && !check_arena_step(arena, budget, __LINE__))
+    {
+        fflush(stdout);
+        abort();
+    }
+}
+
+/*
+ * place: place the given size into the given block
+ *     check if the remainning is big enough to make a new free block
+ *     if it is split the block into two, does not split otherwise.
+ */
+static void place(arena_t *arena, block_t *block, size_t asize)
+{
+    //dbg_printf("Place: \nf");
+    //mm_printheap();
+    size_t csize = get_size(block);
+    //remove block from freelist because it's no longer free
+    fl_remove(arena, block);
+    //the released pages of the last block are in use again
+    if (arena->top_released != NULL && (char *)block + asize > arena->top_released)
+        arena->top_released = NULL;
+    //so are the pages of a decommitted block, a big one gets them at once
+    if (block->header & decommit_mask)
+        prefault(header_to_payload(block), asize - wsize);
+    //the block takes zero memory, calloc need not clear it again.
+    //a split writes the header and links of the rest past the block
+    if (arena->zero_from != NULL
+        && (char *)header_to_payload(block) + asize + dsize > arena->zero_from)
+    {
+        arena->zero_alloc = block;
+        arena->zero_alloc_from = arena->zero_from;
+        //past the header and links of the rest, or nothing if it is all used
+        arena->zero_from = ((csize - asize) >= policy.split_min)
+            ? (char *)header_to_payload(block) + asize + dsize : NULL;
+    }
+
+    //place case 1: split block if the remainning size is bigger than min size
+    if ((csize - asize) >= policy.split_min)
+    {
+        block_t *block_next;
+        /*only write the header of the block because it is allocated*/
+        write_header(block, asize, get_prev_alloc(block), true);
+        //write_footer(block, asize, get_prev_alloc(block), true);
+        
+        /*for the rest block size write footer and write header
+            because it is a new free block*/
+        block_next = find_next(block);
+        write_header(block_next, csize-asize, true, false);
+        write_footer(block_next, csize-asize, true, false);
+
+        //set the prev and next in block_next to 0 since it's a new free block
+        block_next->prev = 0;
+        block_next->next = 0;
+        
+        //dbg_printf("Place case 1: \n");
+        //mm_printheap();
+        //set_next_prev_alloc(block, true);
+
+        //coalesce for the new free block and put it in freelist
+        coalesce(arena, block_next);
+        arena->stats.splits++;
+    }
+    /*place case 2 when the rest size is smaller than policy.split_min
+        does not split the block*/
+    else
+    { 
+        /*only write header to the block because it is now allocated*/
+        write_header(block, csize, get_prev_alloc(block), true);
+        //write_footer(block, csize, get_prev_alloc(block), true);
+ 
+        /*set the next block's prev_alloc to true
+            because we do not coalesce here, 
+            we need to set it by calling the set_prev function*/
+        set_next_prev_alloc(block, true);
+        //dbg_printf("Place case 2: \n");
+        //mm_printheap();
+    }
+}
+
+/*
+ * place_batch: carves up to n allocated blocks of asize bytes one after
+ *     another out of a free block and stores their payloads in out.
+ *     the rest is split off like place does, or goes to the last block.
+ *     returns how many blocks were carved.
+ */
+static size_t place_batch(arena_t *arena, block_t *block, size_t asize,
+                          size_t n, void **out)
+{
+    size_t csize = get_size(block);
+    size_t count = min(csize / asize, n);
+    bool prev_alloc = get_prev_alloc(block);
+
+    fl_remove(arena, block);
+    //the released pages of the last block are in use again
+    if (arena->top_released != NULL && (char *)block + count * asize > arena->top_released)
+        arena->top_released = NULL;
+    if (arena->zero_from != NULL && (char *)block + csize > arena->zero_from)
+        arena->zero_from = NULL;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t size = asize;
+        //the last block takes a rest too small to be a free block
+        if (i == count - 1 && csize - count * asize < policy.split_min)
+            size = csize - i * asize;
+        write_header(block, size, prev_alloc, true);
+        out[i] = header_to_payload(block);
+        prev_alloc = true;
+        block = find_next(block);
+    }
+
+    if (csize - count * asize >= policy.split_min)
+    {
+        write_header(block, csize - count * asize, true, false);
+        write_footer(block, csize - count * asize, true, false);
+        block->prev = NULL;
+        block->next = NULL;
+        coalesce(arena, block);
+        arena->stats.splits++;
+    }
+    else
+    {
+        set_next_prev_alloc(payload_to_header(out[count - 1]), true);
+    }
+    return count;
+}
+
+/*
+ * compare_address: orders payloads by address for qsort
+ */
+static int compare_address(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t)*(void *const *)a;
+    uintptr_t y = (uintptr_t)*(void *const *)b;
+
+    return (x > y) - (x < y);
+}
+
+#ifdef TLSF
+/*
+ * find_fit: rounds asize up to the start of the next second-level list,
+ *     so that every block in the chosen list is big enough, then uses
+ *     the two bitmaps to pick the first non-empty list in O(1)
+ */
+static block_t *find_fit(arena_t *arena, size_t asize)
+{
+    int fl, sl;
+    uint32_t sl_map;
+    word_t fl_map;
+
+    arena->stats.fit_searches++;
+    //no list holds sizes this big, and the rounding must not wrap around
+    if (asize >= tlsf_max_size)
+        return NULL;
+    if (asize >= tlsf_small_size)
+    {
+        int f = 63 - __builtin_clzll(asize);
+        asize += ((size_t)1 << (f - TLSF_SL_LOG2)) - 1;
+    }
+    if (asize >= tlsf_max_size)
+        return NULL; // no fit found
+    fl = get_seg_index(asize) >> TLSF_SL_LOG2;
+    sl = get_seg_index(asize) & (TLSF_SL_COUNT - 1);
+
+    //look for a non-empty list in the same first-level list first
+    sl_map = arena->tlsf_sl_bitmap[fl] & (~(uint32_t)0 << sl);
+    if (sl_map == 0)
+    {
+        //otherwise take the smallest non-empty bigger first-level list
+        fl_map = arena->tlsf_fl_bitmap & (~(word_t)0 << (fl + 1));
+        if (fl_map == 0)
+            return NULL; // no fit found
+        fl = __builtin_ctzll(fl_map);
+        sl_map = arena->tlsf_sl_bitmap[fl];
+    }
+    sl = __builtin_ctz(sl_map);
+    arena->stats.fit_probes++;
+    return arena->freelist_start[fl * TLSF_SL_COUNT + sl];
+}
+#elif defined(DENSE_INDEX)
+/*
+ * find_fit: the nth fit policy of the segregated lists, but the sizes
+ *     are read from the arrays, so only the chosen block is touched
+ */
+static block_t *find_fit(arena_t *arena, size_t asize)
+{
+    int index = get_seg_index(asize);
+    dense_index_t *dense;
+    block_t *best_fit;
+    word_t bigger;
+
+    arena->stats.fit_searches++;
+    //blocks in asize's own class may still be too small, search it
+    best_fit = find_fit_in_array(arena, &arena->dense_index[index], asize);
+    if (best_fit != NULL || index == SEG_LIST_COUNT - 1)
+        return best_fit;
+
+    //smaller classes can never hold a block of asize, mask them out
+    bigger = arena->seg_list_bitmap & ~(((word_t)1 << (index + 1)) - 1);
+    if (bigger == 0)
+        return NULL; // no fit found
+    index = __builtin_ctzll(bigger);
+    dense = &arena->dense_index[index];
+
+    //the last class has no upper bound, so it still needs a search
+    if (index == SEG_LIST_COUNT - 1)
+        return find_fit_in_array(arena, dense, asize);
+    arena->stats.fit_probes++;
+    return dense->entries[dense->count - 1].block;
+}
+
+/*
+ * find_fit_in_array: compares the first policy.fit_probes fits of a class array,
+ *     newest first, and returns a perfect fit as soon as it sees one
+ */
+static block_t *find_fit_in_array(arena_t *arena, dense_index_t *dense, size_t asize)
+{
+    uint32_t best = 0;
+    int fits = 0;
+
+    for (uint32_t i = dense->count; i-- > 0 && fits < policy.fit_probes;)
+    {
+        size_t size = dense->entries[i].size;
+        arena->stats.fit_probes++;
+        if (size == asize)
+            return dense->entries[i].block;
+        if (size > asize && (fits++ == 0 || size < dense->entries[best].size))
+            best = i;
+    }
+    return (fits != 0) ? dense->entries[best].block : NULL;
+}
+#elif defined(BEST_FIT_TREE)
+/*
+ * find_fit: finds the smallest block of at least asize bytes, the one with
+ *     the lowest address among equal sizes. only asize's own class can
+ *     hold smaller blocks, the first non-empty bigger class just gives
+ *     its smallest block.
+ */
+static block_t *find_fit(arena_t *arena, size_t asize)
+{
+    int index = get_seg_index(asize);
+    block_t *t = arena->freelist_start[index];
+    block_t *best_fit = NULL;
+    word_t bigger;
+
+    arena->stats.fit_searches++;
+    //every block left of a fit is smaller, so keep going left after one
+    while (t != NULL)
+    {
+        arena->stats.fit_probes++;
+        if (get_size(t) >= asize)
+        {
+            best_fit = t;
+            t = t->prev;
+        }
+        else
+            t = t->next;
+    }
+    if (best_fit != NULL || index == SEG_LIST_COUNT - 1)
+        return best_fit;
+
+    bigger = arena->seg_list_bitmap & ~(((word_t)1 << (index + 1)) - 1);
+    if (bigger == 0)
+        return NULL; // no fit found
+    t = arena->freelist_start[__builtin_ctzll(bigger)];
+    arena->stats.fit_probes++;
+    while (t->prev != NULL)
+    {
+        t = t->prev;
+        arena->stats.fit_probes++;
+    }
+    return t;
 }
-
+#else
 /*
- * place: place the given size into the given block
- *     check if the remainning is big enough to make a new free block
- *     if it is split the block into two, does not split otherwise.
+ * find_fit: uses nth fit method in the segregated list that asize
+ *     belongs to, then uses the bitmap to jump straight to the first
+ *     non-empty bigger list, where every block is big enough
  */
-static void place(block_t *block, size_t asize)
+static block_t *find_fit(arena_t *arena, size_t asize)
 {
-    //dbg_printf("Place: \nf");
-    //mm_printheap();
-    size_t csize = get_size(block);
-    //remove block from freelist because it's no longer free
-    fl_remove(block);
+    int index = get_seg_index(asize);
+    block_t *best_fit;
+    word_t bigger;
 
-    //place case 1: split block if the remainning size is bigger than min size
-    if ((csize - asize) >= min_block_size)
-    {
-        block_t *block_next;
-        /*only write the header of the block because it is allocated*/
-        write_header(block, asize, get_prev_alloc(block), true);
-        //write_footer(block, asize, get_prev_alloc(block), true);
-        
-        /*for the rest block size write footer and write header
-            because it is a new free block*/
-        block_next = find_next(block);
-        write_header(block_next, csize-asize, true, false);
-        write_footer(block_next, csize-asize, true, false);
+    arena->stats.fit_searches++;
+    //blocks in asize's own list may still be too small, search it
+    best_fit = find_fit_in_list(arena, arena->freelist_start[index], asize);
+    if (best_fit != NULL || index == SEG_LIST_COUNT - 1)
+        return best_fit;
 
-        //set the prev and next in block_next to 0 since it's a new free block
-        block_next->prev = 0;
-        block_next->next = 0;
-        
-        //dbg_printf("Place case 1: \n");
-        //mm_printheap();
-        //set_next_prev_alloc(block, true);
+    //smaller lists can never hold a block of asize, mask them out
+    bigger = arena->seg_list_bitmap & ~(((word_t)1 << (index + 1)) - 1);
+    if (bigger == 0)
+        return NULL; // no fit found
+    index = __builtin_ctzll(bigger);
 
-        //coalesce for the new free block and put it in freelist
-        coalesce(block_next);
-    }
-    /*place case 2 when the rest size is smaller than min_block_size
-        does not split the block*/
-    else
-    { 
-        /*only write header to the block because it is now allocated*/
-        write_header(block, csize, get_prev_alloc(block), true);
-        //write_footer(block, csize, get_prev_alloc(block), true);
- 
-        /*set the next block's prev_alloc to true
-            because we do not coalesce here, 
-            we need to set it by calling the set_prev function*/
-        set_next_prev_alloc(block, true);
-        //dbg_printf("Place case 2: \n");
-        //mm_printheap();
-    }
+    //the last list has no upper bound, so it still needs a search
+    if (index == SEG_LIST_COUNT - 1)
+        return find_fit_in_list(arena, arena->freelist_start[index], asize);
+    arena->stats.fit_probes++;
+    return arena->freelist_start[index];
 }
 
 /*
- * find_fit: uses nth fit method to find a fit for the given size
+ * find_fit_in_list: uses nth fit method to find a fit for the given size
+ *     in the freelist that begins at start
  */
-static block_t *find_fit(size_t asize)
+static block_t *find_fit_in_list(arena_t *arena, block_t *start, size_t asize)
 {
-    //dbg_printf("find_fit start: \n");
-    //mm_printheap();
     block_t *block;
     block_t *best_fit=NULL;
     int i = 0;
-    //dbg_printf("freelist: \n");
-    //mm_printfreelist();
 
     //use for loop to find the nth fit
-    //find the first 50 blocks that fit asize and compare them
-    for (block = freelist_start; block != 0 && i<50;
+    //find the first policy.fit_probes blocks that fit asize and compare them
+    for (block = start; block != 0 && i<policy.fit_probes;
                              block = block->next)
     {
+        arena->stats.fit_probes++;
         //if the block size equals asize, it a perfect fit
         //  return immediately
         if (asize == get_size(block))
@@ -603,7 +3837,7 @@ static block_t *find_fit(size_t asize)
                 best_fit = block;
             }
             //repeat this step until we search the entire freelist
-            //  or we find 50 fits already, then return the current best fit
+            //  or we find enough fits already, then return the current best fit
             i++;
         }
         
@@ -612,6 +3846,7 @@ static block_t *find_fit(size_t asize)
 
     return best_fit; // no fit found
 }
+#endif
 
 
 
@@ -622,59 +3857,212 @@ static block_t *find_fit(size_t asize)
  */
 bool mm_checkheap(int line)  
 { 
-    // delete this line; it's a placeholder so that the compiler
-    // will not warn you about an unused variable.
-    //check if all free blocks are coalesced
-    if(!check_freeblock_coalesce()){
-        printf("Fail: check free blocks coalesced LINE: %d\n", line);
-        return false;
+    bool ok = true;
+    //check every arena that has a heap, one at a time
+    for (int i = 0; ok && i < ARENA_COUNT; i++)
+    {
+        pthread_mutex_lock(&arenas[i].lock);
+        if (arenas[i].heap_start != NULL)
+            ok = check_arena(&arenas[i], line);
+        pthread_mutex_unlock(&arenas[i].lock);
     }
+    return ok;
+}
+
+/*
+ * check_arena: checks the invariants of one arena,
+ *     requires its lock
+ */
+bool check_arena(arena_t *arena, int line)
+{
+    size_t free_count = 0;
+    size_t free_bytes = 0;
+    block_t *cursor = arena->heap_start;
 
-    //check the prev_alloc bit are set correctly
-    if(!check_prev_alloc()){
-        printf("Fail: check prev alloc LINE: %d\n", line);
+    //one walk checks every block of the heap against its neighbors
+    if(!check_blocks(arena, &cursor, SIZE_MAX, &free_count, &free_bytes)){
+        printf("Fail: check heap blocks LINE: %d\n", line);
         return false;
     }
 
     //check all the freeblocks are in the freelist
-    if(!check_all_freeblocks_in_freelist()){
+    if(!check_all_freeblocks_in_freelist(arena, free_count)){
         printf("Fail: check all free block in freelist LINE: %d\n", line);
         return false;
     }
- 
-    //check all the blocks are bigger than minimum block size
-    if(!check_if_size_smaller_than_minsize()){
-        printf("Fail: check if block size is smaller than min block size LINE: %d\n", line);
-        return false;
-    }
 
     //check all the freeblocks are linked to each other
-    if(!check_freelist_correctly_linked()){
+    if(!check_freelist_correctly_linked(arena)){
         printf("Fail: check freelist correctly linked LINE: %d\n", line);
         return false;
     }
 
-    //check if the allocated blocks are overlapping
-    if(!check_alloc_block_overlap()){
-        printf("Fail: check alloc block overlap LINE: %d\n", line);
+    //check all the freeblocks are in the list matching their size
+    if(!check_freeblock_in_right_list(arena)){
+        printf("Fail: check freeblock in right list LINE: %d\n", line);
+        return false;
+    }
+
+    //check the bitmap matches which freelists are empty
+    if(!check_list_bitmap(arena)){
+        printf("Fail: check list bitmap LINE: %d\n", line);
+        return false;
+    }
+
+    //check the slab pages on the partial lists are consistent
+    if(!check_slab_pages(arena)){
+        printf("Fail: check slab pages LINE: %d\n", line);
+        return false;
+    }
+
+    //check the blocks waiting in the quick bins
+    if(!check_quick_bins(arena)){
+        printf("Fail: check quick bins LINE: %d\n", line);
         return false;
     }
 
-    if(!check_pointer_valid()){
-        printf("Fail: check pointers valid LINE: %d\n", line);
+    //check the byte counters of mm_stats match the heap
+    if(!check_stats(arena, free_bytes)){
+        printf("Fail: check stats LINE: %d\n", line);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * mm_checkheap_step: checks the next budget blocks of every heap,
+ *     resuming where the last call stopped
+ */
+int mm_checkheap_step(size_t budget)
+{
+    bool ok = true;
+    for (int i = 0; ok && i < ARENA_COUNT; i++)
+    {
+        pthread_mutex_lock(&arenas[i].lock);
+        if (arenas[i].heap_start != NULL)
+            ok = check_arena_step(&arenas[i], budget, __LINE__);
+        pthread_mutex_unlock(&arenas[i].lock);
+    }
+    return ok;
+}
+
+/*
+ * check_arena_step: checks the next budget blocks of one arena's heap
+ *     from its check_cursor, starting over at the first block after
+ *     the last one. only what a block and its neighbors show is checked,
+ *     so the cost does not grow with the heap. requires its lock
+ */
+bool check_arena_step(arena_t *arena, size_t budget, int line)
+{
+    size_t free_count = 0;
+    size_t free_bytes = 0;
+
+    if (arena->check_cursor == NULL)
+        arena->check_cursor = arena->heap_start;
+    if (!check_blocks(arena, &arena->check_cursor, budget, &free_count, &free_bytes))
+    {
+        printf("Fail: check heap blocks at %p LINE: %d\n",
+               (void *)arena->check_cursor, line);
         return false;
     }
     return true;
 }
 
+/*
+ * check_blocks:
+ *   walk up to budget blocks of the heap from *cursor in one pass and
+ *   check what each block and the block after it show: the size is a
+ *   multiple of dsize and at least min_block_size, the block ends inside
+ *   the heap, the prev_alloc bit of the next block matches, and a free
+ *   block is not followed by another one, has a footer equal to its
+ *   header and is linked into the free block index.
+ *   adds the indexed free blocks to free_count and the bytes of all free
+ *   blocks to free_bytes. *cursor is left at the first block not checked,
+ *   NULL once the walk reached the epilogue, and at the bad block if it
+ *   finds a problem.
+ *   return false if find any, true otherwise.
+ */
+bool check_blocks(arena_t *arena, block_t **cursor, size_t budget,
+                  size_t *free_count, size_t *free_bytes){
+    block_t *epilogue = arena_epilogue(arena);
+    block_t *block = *cursor;
+    block_t *next;
+    size_t size;
+
+    for (; budget > 0 && block != epilogue; budget--, block = next)
+    {
+        *cursor = block;
+        size = get_size(block);
+        if (size < min_block_size || size % dsize != 0
+            || size > (size_t)((char *)epilogue - (char *)block))
+            return false;
+        next = find_next(block);
+        if (get_prev_alloc(next) != get_alloc(block))
+            return false;
+        if (get_alloc(block))
+            continue;
+        if (!get_alloc(next) || *find_prev_footer(next) != block->header
+            || !check_free_links(arena, block))
+            return false;
+        *free_bytes += size;
+#ifdef DENSE_INDEX
+        //blocks that did not fit in a full array are in no class
+        if ((uintptr_t)block->prev == dense_unindexed)
+            continue;
+#endif
+        (*free_count)++;
+    }
+    if (block == epilogue)
+    {
+        if (get_size(block) != 0 || !get_alloc(block))
+        {
+            *cursor = block;
+            return false;
+        }
+        block = NULL;
+    }
+    *cursor = block;
+    return true;
+}
+
+/*
+ * check_free_links:
+ *   check that a free block is where the free block index says it is,
+ *   looking only at its own links and at the blocks they point to.
+ *   return false if find any problem, true otherwise.
+ */
+bool check_free_links(arena_t *arena, block_t *block){
+#if defined(DENSE_INDEX)
+    dense_index_t *dense = &arena->dense_index[get_seg_index(get_size(block))];
+    uintptr_t pos = (uintptr_t)block->prev;
+    return pos == dense_unindexed
+        || (pos < dense->count && dense->entries[pos].block == block
+            && dense->entries[pos].size == get_size(block));
+#elif defined(BEST_FIT_TREE)
+    (void)arena;
+    //a node has no parent link, so only its children are checked
+    if (block->prev != NULL && (!tree_less(block->prev, block)
+            || tree_priority(block->prev) > tree_priority(block)))
+        return false;
+    return block->next == NULL || (tree_less(block, block->next)
+            && tree_priority(block->next) <= tree_priority(block));
+#else
+    int index = get_seg_index(get_size(block));
+    if (block->prev == NULL ? arena->freelist_start[index] != block
+                            : block->prev->next != block)
+        return false;
+    return block->next == NULL || block->next->prev == block;
+#endif
+}
+
 //checkheap helper functions
 /*
  * mm_printheap: 
  *   print out the entire heap using loop.
  */
-void mm_printheap(){
+void mm_printheap(arena_t *arena){
     block_t *b;
-    for (b = heap_start; get_size(b) != 0;
+    for (b = arena->heap_start; get_size(b) != 0;
 		b = find_next(b)) {
 	dbg_printf("%p:\tsize: %lu\talloc: %d\tprev_alloc: %d",
 		b, get_size(b), get_alloc(b), get_prev_alloc(b));
@@ -689,11 +4077,23 @@ void mm_printheap(){
 
 /*
  * mm_printfreelist: 
- *   print out the entire freelist using loop.
+ *   print out every segregated freelist using loop.
  */
-void mm_printfreelist(){
+void mm_printfreelist(arena_t *arena){
+#if defined(DENSE_INDEX)
+    for (int i = 0; i < SEG_LIST_COUNT; i++)
+    for (uint32_t k = 0; k < arena->dense_index[i].count; k++) {
+	dense_entry_t *e = &arena->dense_index[i].entries[k];
+	printf("%p:\tsize: %lu\tclass: %d\tposition: %u\n",
+		e->block, e->size, i, k);
+    }
+#elif defined(BEST_FIT_TREE)
+    for (int i = 0; i < FREELIST_COUNT; i++)
+        mm_printtree(arena->freelist_start[i]);
+#else
     block_t *b;
-    for (b = freelist_start; b != 0;
+    for (int i = 0; i < FREELIST_COUNT; i++)
+    for (b = arena->freelist_start[i]; b != 0;
 		b = b->next) {
 	printf("%p:\tsize: %lu\talloc: %d\tprev_alloc: %d",
 		b, get_size(b), get_alloc(b), get_prev_alloc(b));
@@ -701,113 +4101,109 @@ void mm_printfreelist(){
 		dbg_printf("\tprev: %p\tnext: %p\n", b->prev, b->next);
 	}
     }
+#endif
 }
 
-
+#ifdef BEST_FIT_TREE
 /*
- * check_freeblock_coalesce: 
- *   loop through heap to check if all the free blocks are
- *   coalesced. Make sure that there is no consecutive free blocks.
- *   return false if find any, true otherwise.
+ * mm_printtree: 
+ *   print out a best fit tree in order using recursion.
  */
-bool check_freeblock_coalesce(){
-    block_t *block;
-    for (block = heap_start; get_size(block) > 0 && get_size(find_next(block)) > 0;
-                             block = find_next(block))
-    {
-
-        if (get_alloc(block)==0 && get_alloc(find_next(block))==0)
-        {
-            return false;  
-        }
-        
-    }
-    return true; 
+void mm_printtree(block_t *root){
+    if (root == NULL)
+        return;
+    mm_printtree(root->prev);
+    printf("%p:\tsize: %lu\tleft: %p\tright: %p\n",
+        root, get_size(root), root->prev, root->next);
+    mm_printtree(root->next);
 }
 
 /*
- * check_prev_alloc: 
- *   loop through heap to check if all the blocks' prev_alloc are
- *   the same as their prev blocks' alloc.
- *   return false if find any, true otherwise.
+ * check_tree: 
+ *   recursively check that every node of a best fit tree is free,
+ *   belongs to class index, is ordered against its children and
+ *   has no lower priority than them.
+ *   return the number of nodes, -1 if find any problem.
  */
-bool check_prev_alloc(){
-    block_t *block;
-    for (block = heap_start; get_size(block) != 0;
-                             block = find_next(block))
-    {
-        if (get_size(find_next(block)) == 0){
-            break;
-        }else{
-            if (get_alloc(block) != get_prev_alloc(find_next(block)))
-            {
-                dbg_printf("\tprev: %p\tnext: %p\n", find_prev(block), find_next(block));
-                return false;  
-            }
-        }     
-    }
-    return true;  
-
+int check_tree(block_t *root, int index){
+    int left, right;
+    if (root == NULL)
+        return 0;
+    if (get_alloc(root) || get_seg_index(get_size(root)) != index)
+        return -1;
+    if (root->prev != NULL && (!tree_less(root->prev, root)
+            || tree_priority(root->prev) > tree_priority(root)))
+        return -1;
+    if (root->next != NULL && (!tree_less(root, root->next)
+            || tree_priority(root->next) > tree_priority(root)))
+        return -1;
+    left = check_tree(root->prev, index);
+    right = check_tree(root->next, index);
+    if (left < 0 || right < 0)
+        return -1;
+    return left + right + 1;
 }
+#endif
+
 
 /*
  * check_all_freeblocks_in_freelist: 
- *   loop through heap to check if 
- *   all the free blocks are in the freelist.
- *   return false if find any, true otherwise.
+ *   count the blocks in the free block index to check if
+ *   they are the count free blocks that check_blocks found in the heap.
+ *   return false if they differ, true otherwise.
  */
-bool check_all_freeblocks_in_freelist(){
-    block_t *b;
-    int i = 0;
-    int j = 0;
-    for (b = heap_start; get_size(b) != 0 && b!=0;
-		b = find_next(b)) {
-        if(!get_alloc(b)){
-            i++;
-        }  
-    }
+bool check_all_freeblocks_in_freelist(arena_t *arena, size_t count){
+    size_t j = 0;
 
-    for (b = freelist_start; b!=0 && get_size(b) != 0;
+#if defined(DENSE_INDEX)
+    for (int k = 0; k < SEG_LIST_COUNT; k++)
+        j += arena->dense_index[k].count;
+#elif defined(BEST_FIT_TREE)
+    for (int k = 0; k < FREELIST_COUNT; k++)
+        j += max(check_tree(arena->freelist_start[k], k), 0);
+#else
+    block_t *b;
+    for (int k = 0; k < FREELIST_COUNT; k++)
+    for (b = arena->freelist_start[k]; b!=0 && get_size(b) != 0;
 		b = b->next) {
         j++; 
     }
+#endif
 
-    if(i!=j){
-        dbg_printf("free blocks in heap: %d\tfreelist: %d\t", i, j);
+    if(count!=j){
+        dbg_printf("free blocks in heap: %zu\tfreelist: %zu\t", count, j);
         return false;
     }else
         return true;
 }
 
 /*
- * check_if_size_smaller_than_minsize: 
- *   loop through heap to check if 
- *   any block has size smaller than the min_block_size.
+ * check_freelist_correctly_linked: 
+ *   loop through every segregated freelist to check if
+ *   each block's next block points back to it.
  *   return false if find any, true otherwise.
  */
-bool check_if_size_smaller_than_minsize(){
-    block_t *block;
-    for (block = heap_start; get_size(block) > 0;
-                             block = find_next(block))
-    {
-
-        if (get_size(block)< min_block_size)
-        {
-            return false;  
-        }
-        
+bool check_freelist_correctly_linked(arena_t *arena){
+#if defined(DENSE_INDEX)
+    //each block knows its position and the entry has its size
+    for (int i = 0; i < SEG_LIST_COUNT; i++)
+    for (uint32_t k = 0; k < arena->dense_index[i].count; k++) {
+        dense_entry_t *e = &arena->dense_index[i].entries[k];
+        if ((uintptr_t)e->block->prev != k || e->size != get_size(e->block))
+            return false;
     }
-    return true; 
-}
-
-/*
- * check_freelist_correctly_linked: 
- *   print out the entire freelist using loop.
- */
-bool check_freelist_correctly_linked(){
+    return true;
+#elif defined(BEST_FIT_TREE)
+    //a tree is linked correctly when it keeps both of its orders
+    for (int i = 0; i < FREELIST_COUNT; i++)
+        if (check_tree(arena->freelist_start[i], i) < 0)
+            return false;
+    return true;
+#else
     block_t *b;
     block_t *next;
-    for (b = freelist_start; b != 0 && b->next != 0;
+    for (int i = 0; i < FREELIST_COUNT; i++)
+    for (b = arena->freelist_start[i]; b != 0 && b->next != 0;
 		b = b->next) {
         next = b->next;
 	if (!(b->next==next && next->prev==b)) {
@@ -815,49 +4211,214 @@ bool check_freelist_correctly_linked(){
 	}
     }
     return true;
+#endif
 }
 
 /*
- * check_alloc_block_overlap: 
- *   loop through heap to check if 
- *   all the blocks + its size equals its next block.
+ * check_freeblock_in_right_list: 
+ *   loop through every segregated freelist to check if
+ *   all the blocks in it are free and belong to its size range.
  *   return false if find any, true otherwise.
  */
-bool check_alloc_block_overlap(){
-    block_t *block;
-    block_t *next;
-    for (block = heap_start; get_size(block) != 0 && find_next(block) != 0;
-                             block = find_next(block))
-    {
-        next = (block_t *)(((char *)block) + get_size(block));
-        if ( next != find_next(block))
-        {
-            return false;  
-        }     
+bool check_freeblock_in_right_list(arena_t *arena){
+#if defined(DENSE_INDEX)
+    for (int i = 0; i < SEG_LIST_COUNT; i++)
+    for (uint32_t k = 0; k < arena->dense_index[i].count; k++) {
+        block_t *b = arena->dense_index[i].entries[k].block;
+        if (get_alloc(b) || get_seg_index(get_size(b)) != i)
+            return false;
     }
-    return true;  
+#elif defined(BEST_FIT_TREE)
+    for (int i = 0; i < FREELIST_COUNT; i++)
+        if (check_tree(arena->freelist_start[i], i) < 0)
+            return false;
+#else
+    block_t *b;
+    for (int i = 0; i < FREELIST_COUNT; i++)
+    for (b = arena->freelist_start[i]; b != 0; b = b->next) {
+        if (get_alloc(b) || get_seg_index(get_size(b)) != i)
+            return false;
+    }
+#endif
+    return true;
 }
 
 /*
- * check_pointer_valid: 
- *   loop through heap to check if 
- *   all the blocks' pointers are valid.
+ * check_list_bitmap: 
+ *   loop through every segregated freelist to check if
+ *   its bit in the bitmap is set exactly when it is not empty.
  *   return false if find any, true otherwise.
  */
-bool check_pointer_valid(){
+bool check_list_bitmap(arena_t *arena){
+    for (int i = 0; i < FREELIST_COUNT; i++) {
+#ifdef DENSE_INDEX
+        if (get_list_bit(arena, i) != (arena->dense_index[i].count != 0))
+            return false;
+#else
+        if (get_list_bit(arena, i) != (arena->freelist_start[i] != NULL))
+            return false;
+#endif
+    }
+#ifdef TLSF
+    for (int i = 0; i < TLSF_FL_COUNT; i++) {
+        if (((arena->tlsf_fl_bitmap >> i) & 1) != (arena->tlsf_sl_bitmap[i] != 0))
+            return false;
+    }
+#endif
+    return true;
+}
+
+/*
+ * check_quick_bins:
+ *   blocks in the quick bins still look allocated, so they pass the
+ *   coalescing and prev_alloc checks. check that each one is allocated,
+ *   has the size of its bin and that the count adds up.
+ */
+bool check_quick_bins(arena_t *arena){
+    uint32_t count = 0;
+    for (int i = 0; i < QUICK_BIN_COUNT; i++)
+    for (block_t *b = arena->quick_bins[i]; b != NULL; b = b->next) {
+        if (++count > arena->quick_count)
+            return false;
+        if (!get_alloc(b) || get_size(b) != i * dsize
+            || is_slab_payload(header_to_payload(b)))
+            return false;
+    }
+    return count == arena->quick_count;
+}
+
+/*
+ * check_stats:
+ *   add up the bytes of the blocks in the quick bins to check if they
+ *   and the free_bytes of the free heap blocks are what the arena
+ *   counters say.
+ *   return false if they differ, true otherwise.
+ */
+bool check_stats(arena_t *arena, size_t free_bytes){
+    size_t quick_bytes = 0;
     block_t *block;
-    for (block = heap_start; get_size(block) > 0;
-                             block = find_next(block))
-    {
-        if ( (char *)(block->header) == NULL)
-            return false;  
-        if ( (char *)(block->payload) == NULL)
+    for (int i = 0; i < QUICK_BIN_COUNT; i++)
+    for (block = arena->quick_bins[i]; block != NULL; block = block->next)
+        quick_bytes += get_size(block);
+    return free_bytes == arena->stats.free_bytes
+        && quick_bytes == arena->stats.quick_bytes;
+}
+
+/*
+ * check_slab_pages: 
+ *   loop through every slab partial list to check if
+ *   each slab is in the pagemap, belongs to the list's class
+ *   and has as many free slots as bits set in its free map.
+ *   return false if find any, true otherwise.
+ */
+bool check_slab_pages(arena_t *arena){
+    slab_t *slab;
+    for (int i = 0; i < SLAB_CLASS_COUNT; i++)
+    for (slab = arena->slab_partial[i]; slab != NULL; slab = slab->next) {
+        uint32_t count = 0;
+        if (!is_slab_payload(slab->slots) || slab->class_index != (uint32_t)i)
+            return false;
+        if (slab->next != NULL && slab->next->prev != slab)
+            return false;
+        for (int w = 0; w < SLAB_MAP_WORDS; w++)
+            count += __builtin_popcountll(slab->free_map[w]);
+        if (count != slab->free_count || count == 0)
             return false;
     }
     return true;
+}
+
+#ifdef TLSF
+/*
+ * get_seg_index: returns the index fl * TLSF_SL_COUNT + sl of the
+ *     freelist that a free block of the given size belongs to, where fl
+ *     is the power of two of the size and sl the next TLSF_SL_LOG2 bits.
+ */
+static int get_seg_index(size_t size)
+{
+    int f, fl, sl;
+    if (size < tlsf_small_size)
+        return size / dsize;
+    f = 63 - __builtin_clzll(size);
+    fl = f - (TLSF_SL_LOG2 + 4) + 1;
+    sl = (size >> (f - TLSF_SL_LOG2)) & (TLSF_SL_COUNT - 1);
+    dbg_assert(fl < TLSF_FL_COUNT);
+    return fl * TLSF_SL_COUNT + sl;
+}
+
+/*
+ * set_list_bit: marks the freelist with the given index as not empty.
+ */
+static void set_list_bit(arena_t *arena, int index)
+{
+    int fl = index >> TLSF_SL_LOG2;
+    arena->tlsf_sl_bitmap[fl] |= (uint32_t)1 << (index & (TLSF_SL_COUNT - 1));
+    arena->tlsf_fl_bitmap |= (word_t)1 << fl;
+}
+
+/*
+ * clear_list_bit: marks the freelist with the given index as empty.
+ */
+static void clear_list_bit(arena_t *arena, int index)
+{
+    int fl = index >> TLSF_SL_LOG2;
+    arena->tlsf_sl_bitmap[fl] &= ~((uint32_t)1 << (index & (TLSF_SL_COUNT - 1)));
+    if (arena->tlsf_sl_bitmap[fl] == 0)
+        arena->tlsf_fl_bitmap &= ~((word_t)1 << fl);
+}
+
+/*
+ * get_list_bit: returns true when the freelist with the given index
+ *     is marked as not empty.
+ */
+static bool get_list_bit(arena_t *arena, int index)
+{
+    int fl = index >> TLSF_SL_LOG2;
+    return (arena->tlsf_sl_bitmap[fl] >> (index & (TLSF_SL_COUNT - 1))) & 1;
+}
+#else
+/*
+ * get_seg_index: returns the index of the segregated freelist
+ *     that a free block of the given size belongs to,
+ *     which is log2(size / min_block_size) capped at the last list.
+ */
+static int get_seg_index(size_t size)
+{
+    int index;
+    if (size < 2*min_block_size)
+        return 0;
+    /*position of the highest set bit, counted from min_block_size*/
+    index = 63 - __builtin_clzll(size) - __builtin_ctzll(min_block_size);
+    if (index > SEG_LIST_COUNT - 1)
+        index = SEG_LIST_COUNT - 1;
+    return index;
+}
+
+/*
+ * set_list_bit: marks the freelist with the given index as not empty.
+ */
+static void set_list_bit(arena_t *arena, int index)
+{
+    arena->seg_list_bitmap |= (word_t)1 << index;
+}
 
+/*
+ * clear_list_bit: marks the freelist with the given index as empty.
+ */
+static void clear_list_bit(arena_t *arena, int index)
+{
+    arena->seg_list_bitmap &= ~((word_t)1 << index);
 }
 
+/*
+ * get_list_bit: returns true when the freelist with the given index
+ *     is marked as not empty.
+ */
+static bool get_list_bit(arena_t *arena, int index)
+{
+    return (arena->seg_list_bitmap >> index) & 1;
+}
+#endif
 
 /*
  * max: returns x if x > y, and y otherwise.
@@ -867,6 +4428,14 @@ static size_t max(size_t x, size_t y)
     return (x > y) ? x : y;
 }
 
+/*
+ * min: returns x if x < y, and y otherwise.
+ */
+static size_t min(size_t x, size_t y)
+{
+    return (x < y) ? x : y;
+}
+
 /*
  * round_up: Rounds size up to next multiple of n
  */
@@ -881,16 +4450,13 @@ static size_t round_up(size_t size, size_t n)
  */
 static word_t pack(size_t size, bool prev_alloc, bool alloc)
 {
-    /*if prev_alloc is false, only pack the alloc_mask*/
-    if(!prev_alloc){
-        return (size | alloc_mask);
-    }else if(!alloc){   /*if alloc is false, only pack the prev_alloc_mask*/
-        return (size | prev_alloc_mask);
-    }else if(alloc&&prev_alloc){  /*if both are true, pack both*/
-        return (size | prev_alloc_mask | alloc_mask);
-    }else    /*if none is true, only return size*/
-        return size;
-
+    word_t word = size;
+    /*pack the prev_alloc_mask and the alloc_mask independently*/
+    if(prev_alloc)
+        word |= prev_alloc_mask;
+    if(alloc)
+        word |= alloc_mask;
+    return word;
 }
 
 
@@ -969,7 +4535,8 @@ static bool get_prev_alloc(block_t *block)
  */
 static void write_header(block_t *block, size_t size, bool prev_alloc, bool alloc)
 {
-    block->header = pack(size, prev_alloc, alloc);
+    //unlocked readers peek at headers, see is_mmap_payload
+    __atomic_store_n(&block->header, pack(size, prev_alloc, alloc), __ATOMIC_RELAXED);
 }
 
 
@@ -990,10 +4557,12 @@ static void write_footer(block_t *block, size_t size, bool prev_alloc, bool allo
  */
 static void set_next_prev_alloc(block_t *block, bool prev_alloc){
     block = find_next(block);
-    block->header = pack(get_size(block), prev_alloc, get_alloc(block));
+    //a sampled or decommitted block keeps its bit
+    __atomic_store_n(&block->header, pack(get_size(block), prev_alloc, get_alloc(block))
+                     | (block->header & (sampled_mask | decommit_mask)), __ATOMIC_RELAXED);
     /*if the block is free, also set prev_alloc in its footer*/
     if(!get_alloc(block))
-        write_footer(block, get_size(block), prev_alloc, get_alloc(block));
+        *find_prev_footer(find_next(block)) = block->header;
 }
 
 /*
@@ -0,0 +1,191 @@
+/*
+ ******************************************************************************
+ *                               mm_ext.h                                     *
+ *        Extensions to the malloc/free/realloc/calloc interface of mm.h      *
+ *                 CSE 361: Introduction to Computer Systems                  *
+ ******************************************************************************
+ */
+
+#ifndef MM_EXT_H
+#define MM_EXT_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Options for mm_mallopt.
+ * MM_OPT_MMAP_THRESHOLD: requests of at least this many bytes get their
+ *     own mmap region instead of a block in the heap (default 128 KiB).
+ */
+#define MM_OPT_MMAP_THRESHOLD 1
+/*
+ * MM_OPT_TRIM_THRESHOLD: a free block of at least this many bytes at the
+ *     end of a heap is given back to the OS by free (default 128 KiB).
+ */
+#define MM_OPT_TRIM_THRESHOLD 2
+/*
+ * MM_OPT_GROWTH_PERCENT: a heap that has to grow does so by this percent
+ *     of its size (default 25), but by no more than
+ * MM_OPT_GROWTH_MAX bytes (default 4 MiB) unless the request needs more.
+ *     0 for either restores fixed 4 KiB extensions.
+ * MM_OPT_PREFAULT_MIN: extensions of at least this many bytes are faulted
+ *     in right away (default 1 MiB), 0 turns it off.
+ */
+#define MM_OPT_GROWTH_PERCENT 3
+#define MM_OPT_GROWTH_MAX 4
+#define MM_OPT_PREFAULT_MIN 5
+/*
+ * MM_OPT_HUGEPAGE: 1 puts every heap set up after the call (arena 0 at
+ *     the next mm_init) in its own 2 MiB aligned mmap range that is
+ *     advised with MADV_HUGEPAGE and grown and trimmed in 2 MiB steps,
+ *     0 goes back to the mem_sbrk heap (default).
+ */
+#define MM_OPT_HUGEPAGE 6
+/*
+ * MM_OPT_DEFER_COALESCE: 1 makes free put blocks up to 1 KiB in quick
+ *     bins that are only coalesced when the heap runs short, 0 coalesces
+ *     every free right away (default).
+ */
+#define MM_OPT_DEFER_COALESCE 7
+/*
+ * MM_OPT_SAMPLE_INTERVAL: malloc and calloc record the call stack of
+ *     about one request per this many bytes until the payload is freed,
+ *     see mm_profile_dump. 0 turns sampling off (default).
+ */
+#define MM_OPT_SAMPLE_INTERVAL 8
+/*
+ * MM_OPT_CHECK_BLOCKS: every malloc and free that takes an arena lock
+ *     checks this many more blocks of the arena's heap, see
+ *     mm_checkheap_step, and aborts if they are corrupted.
+ *     0 turns it off (default).
+ */
+#define MM_OPT_CHECK_BLOCKS 9
+/*
+ * MM_OPT_GUARD_INTERVAL: about one malloc or calloc of up to 4 KiB in
+ *     this many gets a page of its own that ends at an inaccessible
+ *     guard page, and is made inaccessible itself when freed and kept
+ *     out of use for as long as possible, so that overflows and use
+ *     after free fault right away. 0 turns it off (default).
+ */
+#define MM_OPT_GUARD_INTERVAL 10
+
+/*
+ * mm_mallopt: sets an allocator option at run time,
+ *     returns 1 on success and 0 for an unknown option or bad value
+ */
+int mm_mallopt(int option, size_t value);
+
+/*
+ * mm_memalign: returns a payload of size bytes aligned to alignment,
+ *     a power of two. mm_posix_memalign and mm_aligned_alloc are the same
+ *     with the POSIX and C11 interfaces. free and realloc work on them as
+ *     usual, realloc only keeps the default 16 byte alignment.
+ */
+void *mm_memalign(size_t alignment, size_t size);
+int mm_posix_memalign(void **memptr, size_t alignment, size_t size);
+void *mm_aligned_alloc(size_t alignment, size_t size);
+
+/*
+ * mm_free_sized: frees a payload allocated (or last reallocated) for size
+ *     bytes, small sizes skip reading any allocator metadata. payloads of
+ *     mm_memalign, mm_posix_memalign and mm_aligned_alloc must be freed
+ *     with free instead, a small one sits in the slab class of its size
+ *     rounded up to the alignment, not in the class of its size.
+ */
+void mm_free_sized(void *bp, size_t size);
+
+/*
+ * mm_malloc_batch: allocates n payloads of size bytes each into out,
+ *     returns how many were allocated (fewer than n only when out of memory)
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void **out);
+
+/*
+ * mm_free_batch: frees n payloads from ptrs, which it reorders
+ */
+void mm_free_batch(void **ptrs, size_t n);
+
+/*
+ * A region hands out memory that is all freed together by
+ * mm_region_reset or mm_region_destroy, there is no free for a single
+ * payload. Payloads are 16 byte aligned. A region must not be used by
+ * two threads at the same time.
+ */
+typedef struct mm_region mm_region_t;
+
+mm_region_t *mm_region_create(void);
+void *mm_region_alloc(mm_region_t *region, size_t size);
+void mm_region_reset(mm_region_t *region);
+void mm_region_destroy(mm_region_t *region);
+
+/*
+ * mm_trim: gives the free memory at the end of every heap back to the OS,
+ *     keeping pad bytes, returns 1 if any memory was released
+ */
+int mm_trim(size_t pad);
+
+/*
+ * mm_decommit: gives the pages inside every free block of at least
+ *     min_size bytes back to the OS, wherever it is in the heap, without
+ *     moving any payload. returns how many bytes were released
+ */
+size_t mm_decommit(size_t min_size);
+
+/*
+ * mm_stats counts mallocs in MM_STATS_CLASS_COUNT classes, class i holding
+ * the sizes whose highest set bit is bit i (sizes 0 and 1 in class 0),
+ * the last class also every bigger size.
+ */
+#define MM_STATS_CLASS_COUNT 40
+
+/*
+ * A snapshot of the allocator counters. The byte counts describe the
+ * heaps at the time of the snapshot, the other counts are totals since
+ * the program started. A realloc that moves a payload counts as a
+ * malloc and a free.
+ */
+typedef struct mm_stats
+{
+    size_t heap_bytes;      /* bytes of all heaps */
+    size_t free_bytes;      /* bytes of their free blocks, quick bins included */
+    size_t in_use_bytes;    /* the rest, slab pages count as in use */
+    size_t mmap_bytes;      /* bytes mapped for requests above the mmap threshold */
+    size_t mallocs;         /* allocation requests, failed ones included */
+    size_t frees;           /* payloads given back */
+    size_t fit_searches;    /* free block searches */
+    size_t fit_probes;      /* free blocks those searches looked at */
+    size_t splits;          /* free blocks split by an allocation */
+    size_t coalesces;       /* free blocks merged with a neighbor */
+    size_t extends;         /* times a heap grew */
+    size_t size_classes[MM_STATS_CLASS_COUNT];  /* mallocs by size class */
+} mm_stats_t;
+
+/*
+ * mm_stats: fills in a snapshot of the counters. It takes each arena lock
+ *     in turn, so it is cheap but not an atomic view of all threads.
+ */
+void mm_stats(mm_stats_t *stats);
+
+/*
+ * mm_profile_dump: writes the live sampled payloads to fd as a heap
+ *     profile in the gperftools text format, which pprof reads along
+ *     with the binary. returns 0 on success and -1 if a write failed.
+ */
+int mm_profile_dump(int fd);
+
+/*
+ * mm_checkheap_step: checks the next budget blocks of every heap against
+ *     their neighbors and the free block index, picking up where the last
+ *     call stopped and starting over after the last block. returns 1 if
+ *     they are fine and 0, after printing the problem, if not.
+ */
+int mm_checkheap_step(size_t budget);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MM_EXT_H */
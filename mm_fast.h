@@ -0,0 +1,121 @@
+/*
+ ******************************************************************************
+ *                               mm_fast.h                                    *
+ *        Inline malloc fast path on top of the thread cache of mm.c          *
+ *                 CSE 361: Introduction to Computer Systems                  *
+ ******************************************************************************
+ */
+
+/*
+ * mm_malloc_fast(size) is malloc compiled into the caller. When the
+ * calling thread has a cached slot of the slab class of size, it pops
+ * it in a dozen instructions, with no call and no lock; otherwise, and
+ * whenever the request is due to be sampled or guarded or the heap was
+ * reset by mm_init, it calls the ordinary malloc, which counts, samples
+ * and guards the request as usual. Either way the payload is freed like
+ * any other.
+ *
+ * The thread cache is declared here only so that the fast path can
+ * reach it, nothing but mm.c and mm_malloc_fast may touch it.
+ *
+ * With DRIVER defined, as for mm.c itself, the fallback is mm_malloc.
+ */
+
+#ifndef MM_FAST_H
+#define MM_FAST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "mm_ext.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * There is one slab class per 16 bytes of size up to MM_FAST_MAX_SIZE,
+ * size s belonging to class (s - 1) / 16
+ */
+#define MM_FAST_CLASS_COUNT 16
+#define MM_FAST_MAX_SIZE (16 * MM_FAST_CLASS_COUNT)
+
+/*
+ * Counters of one thread, only that thread writes them and mm_stats
+ * reads them, both with relaxed atomics so that no lock is needed
+ */
+typedef struct mm_thread_stats
+{
+    size_t mallocs;
+    size_t frees;
+    size_t size_classes[MM_STATS_CLASS_COUNT];
+} mm_thread_stats_t;
+
+typedef struct mm_tcache
+{
+    /* Cached slots of each class, linked through their first word */
+    void *bins[MM_FAST_CLASS_COUNT];
+    uint32_t counts[MM_FAST_CLASS_COUNT];
+    /* mm_heap_generation the slots belong to, 0 if never used */
+    unsigned long generation;
+    bool registered;    // the thread exit destructor is set up
+    mm_thread_stats_t stats;
+    size_t sample_left;     // bytes to allocate until the next sample
+    size_t guard_left;      // mallocs until the next guarded one
+    uint64_t sample_seed;   // state of the random gaps, 0 until first used
+    bool sampling;          // set while a sample is taken, nothing nested is
+    /* Links the cache into the list of live caches until the thread exits */
+    struct mm_tcache *stats_prev;
+    struct mm_tcache *stats_next;
+} mm_tcache_t;
+
+/*the cache of the calling thread*/
+extern __thread mm_tcache_t mm_tcache;
+/*bumped by mm_init so thread caches drop slots of an older heap*/
+extern unsigned long mm_heap_generation;
+
+#ifdef DRIVER
+void *mm_malloc(size_t size);
+#endif
+
+/*
+ * mm_malloc_fast: malloc with the thread cache hit inlined. a bin that
+ *     holds a slot implies the thread is registered for the counters,
+ *     since only the slow path fills bins and it registers first.
+ */
+static inline void *mm_malloc_fast(size_t size)
+{
+    size_t index = (size - 1) >> 4;     // size 0 wraps around to a miss
+    void *bp;
+
+    if (index < MM_FAST_CLASS_COUNT && size < mm_tcache.sample_left
+        && mm_tcache.guard_left > 1 && mm_tcache.generation == mm_heap_generation
+        && (bp = mm_tcache.bins[index]) != NULL)
+    {
+        //the same counting as malloc, size is at least 1 here
+        size_t *klass = &mm_tcache.stats.size_classes[63 - __builtin_clzll(size)];
+        mm_tcache.bins[index] = *(void **)bp;
+        mm_tcache.counts[index]--;
+        mm_tcache.sample_left -= size;
+        mm_tcache.guard_left--;
+        __atomic_store_n(&mm_tcache.stats.mallocs,
+                         __atomic_load_n(&mm_tcache.stats.mallocs, __ATOMIC_RELAXED) + 1,
+                         __ATOMIC_RELAXED);
+        __atomic_store_n(klass, __atomic_load_n(klass, __ATOMIC_RELAXED) + 1,
+                         __ATOMIC_RELAXED);
+        return bp;
+    }
+#ifdef DRIVER
+    return mm_malloc(size);
+#else
+    return malloc(size);
+#endif
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MM_FAST_H */
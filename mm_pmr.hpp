@@ -0,0 +1,262 @@
+/*
+ ******************************************************************************
+ *                               mm_pmr.hpp                                   *
+ *        C++ memory resources and STL allocators on top of mm_ext.h          *
+ *                 CSE 361: Introduction to Computer Systems                  *
+ ******************************************************************************
+ */
+
+/*
+ * mm::region_resource gives a container a pool of its own: nodes come
+ * out of an mm_region_t one after the other, so they sit next to each
+ * other, and destroying or release()ing the resource frees all of them
+ * at once without visiting a single node. Nodes a container frees are
+ * kept for the next node of the same size. Like a region it must not be
+ * used by two threads at the same time.
+ *
+ *     mm::region_resource pool;
+ *     std::pmr::map<int, std::pmr::string> m(&pool);
+ *
+ * mm::heap_resource() is the default heap as a memory_resource, using the
+ * aligned and sized-free entry points, and mm::allocator<T> is the same
+ * as a plain STL allocator.
+ *
+ * With DRIVER defined, as for mm.c itself, the driver names mm_malloc and
+ * mm_free are used instead of malloc and free.
+ */
+
+#ifndef MM_PMR_HPP
+#define MM_PMR_HPP
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+#include <memory_resource>
+
+#include "mm_ext.h"
+
+#ifdef DRIVER
+extern "C" {
+void *mm_malloc(size_t size);
+void mm_free(void *ptr);
+}
+#endif
+
+namespace mm {
+
+namespace detail {
+
+/*payloads of the allocator are aligned to this many bytes*/
+constexpr std::size_t payload_align = 16;
+
+/*allocates bytes aligned to align, throws std::bad_alloc if it cannot*/
+inline void *allocate(std::size_t bytes, std::size_t align)
+{
+    void *bp;
+    if (bytes == 0)
+        bytes = 1;      // every allocation must be a distinct pointer
+#ifdef DRIVER
+    bp = (align <= payload_align) ? mm_malloc(bytes) : mm_memalign(align, bytes);
+#else
+    bp = (align <= payload_align) ? std::malloc(bytes) : mm_memalign(align, bytes);
+#endif
+    if (bp == nullptr)
+        throw std::bad_alloc();
+    return bp;
+}
+
+/*frees what allocate returned for the same bytes and align*/
+inline void deallocate(void *bp, std::size_t bytes, std::size_t align) noexcept
+{
+    if (bytes == 0)
+        bytes = 1;
+    //an aligned payload may sit in a bigger slab class than its size
+    if (align <= payload_align)
+        mm_free_sized(bp, bytes);
+    else
+#ifdef DRIVER
+        mm_free(bp);
+#else
+        std::free(bp);
+#endif
+}
+
+} // namespace detail
+
+/*
+ * memory_resource of the default heap, every instance is the same heap
+ */
+class heap_memory_resource : public std::pmr::memory_resource
+{
+private:
+    void *do_allocate(std::size_t bytes, std::size_t align) override
+    {
+        return detail::allocate(bytes, align);
+    }
+
+    void do_deallocate(void *bp, std::size_t bytes, std::size_t align) override
+    {
+        detail::deallocate(bp, bytes, align);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return dynamic_cast<const heap_memory_resource *>(&other) != nullptr;
+    }
+};
+
+/*returns the default heap as a memory_resource*/
+inline heap_memory_resource *heap_resource() noexcept
+{
+    static heap_memory_resource resource;
+    return &resource;
+}
+
+/*
+ * memory_resource that carves everything out of one mm_region_t.
+ * deallocated nodes up to reuse_max bytes wait in a list per 16 bytes of
+ * size for the next allocation of that size, bigger ones stay in the
+ * region until release() or the destructor frees it all.
+ */
+class region_resource : public std::pmr::memory_resource
+{
+public:
+    static constexpr std::size_t reuse_max = 512;
+
+    region_resource()
+        : region_(mm_region_create())
+    {
+        if (region_ == nullptr)
+            throw std::bad_alloc();
+    }
+
+    region_resource(const region_resource &) = delete;
+    region_resource &operator=(const region_resource &) = delete;
+
+    ~region_resource() override
+    {
+        mm_region_destroy(region_);
+    }
+
+    /*frees every node at once, containers using the resource must be gone*/
+    void release() noexcept
+    {
+        mm_region_reset(region_);
+        for (node *&list : lists_)
+            list = nullptr;
+    }
+
+private:
+    /*a deallocated node, linked through its first word*/
+    struct node
+    {
+        node *next;
+    };
+
+    static constexpr std::size_t list_count = reuse_max / detail::payload_align + 1;
+
+    static std::size_t list_index(std::size_t bytes) noexcept
+    {
+        return (bytes + detail::payload_align - 1) / detail::payload_align;
+    }
+
+    void *do_allocate(std::size_t bytes, std::size_t align) override
+    {
+        char *bp;
+        if (bytes == 0)
+            bytes = 1;
+        if (bytes <= reuse_max && align <= detail::payload_align)
+        {
+            node *&list = lists_[list_index(bytes)];
+            if (list != nullptr)
+            {
+                node *reused = list;
+                list = reused->next;
+                return reused;
+            }
+            //the node may come back for any size of its list
+            bytes = list_index(bytes) * detail::payload_align;
+        }
+        //region payloads are 16 byte aligned, more takes some slack
+        if (align > detail::payload_align)
+        {
+            if (bytes > SIZE_MAX - align)
+                throw std::bad_alloc();
+            bytes += align - detail::payload_align;
+        }
+        bp = static_cast<char *>(mm_region_alloc(region_, bytes));
+        if (bp == nullptr)
+            throw std::bad_alloc();
+        if (align > detail::payload_align)
+            bp = reinterpret_cast<char *>(
+                (reinterpret_cast<std::uintptr_t>(bp) + align - 1) & ~(std::uintptr_t)(align - 1));
+        return bp;
+    }
+
+    void do_deallocate(void *bp, std::size_t bytes, std::size_t align) override
+    {
+        if (bytes == 0)
+            bytes = 1;
+        if (bytes <= reuse_max && align <= detail::payload_align)
+        {
+            node *&list = lists_[list_index(bytes)];
+            node *freed = static_cast<node *>(bp);
+            freed->next = list;
+            list = freed;
+        }
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    mm_region_t *region_;
+    node *lists_[list_count] = {};
+};
+
+/*
+ * STL allocator of the default heap, frees with the size it allocated
+ */
+template <class T>
+class allocator
+{
+public:
+    using value_type = T;
+
+    allocator() noexcept = default;
+
+    template <class U>
+    allocator(const allocator<U> &) noexcept
+    {
+    }
+
+    T *allocate(std::size_t n)
+    {
+        if (n > SIZE_MAX / sizeof(T))
+            throw std::bad_array_new_length();
+        return static_cast<T *>(detail::allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *bp, std::size_t n) noexcept
+    {
+        detail::deallocate(bp, n * sizeof(T), alignof(T));
+    }
+};
+
+template <class T, class U>
+bool operator==(const allocator<T> &, const allocator<U> &) noexcept
+{
+    return true;
+}
+
+template <class T, class U>
+bool operator!=(const allocator<T> &, const allocator<U> &) noexcept
+{
+    return false;
+}
+
+} // namespace mm
+
+#endif /* MM_PMR_HPP */